@@ -1,6 +1,7 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
@@ -21,16 +22,25 @@ struct dir_entry {
 bool dir_parse(struct dir* current_dir, const char* path_, struct dir** parsed_dir, char** name) {
 	ASSERT(current_dir!=NULL);
 	if (path_[0]=='\0') return false;
+	struct dir* dir = current_dir;
 	if (path_[0]=='/') {
-		return dir_parse(dir_open_root(), path_+1, parsed_dir, name);
+		dir = dir_open_root();
+		path_++;
 	}
 	char* path = malloc(sizeof(char)*PATH_MAX);
-	strlcpy(path, path_, strlen(path_)+1);
-	if (path[strlen(path)-1]=='/') {
-		path[strlen(path)-1] = '\0';
-		return dir_parse(current_dir, path, parsed_dir, name);
+	if (dir==NULL || path==NULL) {
+		free(path);
+		goto fail;
 	}
-	// 여기까지 온 path는 시작과 끝에 '/'를 가질 수 없음
+	strlcpy(path, path_, PATH_MAX);
+	// 끝의 '/'는 떼어냄
+	for (size_t len = strlen(path); len > 0 && path[len-1]=='/'; len--)
+		path[len-1] = '\0';
+	if (path[0]=='\0') {
+		free(path);
+		goto fail;
+	}
+	// 여기까지 온 path는 끝에 '/'를 가질 수 없음
 
 	char* ptr_slash = strrchr(path, '/'); // path 뒤에서부터 '/'의 인덱스를 찾음
 	
@@ -38,19 +48,28 @@ bool dir_parse(struct dir* current_dir, const char* path_, struct dir** parsed_d
 	if (ptr_slash!=NULL) {
 		// 마지막 '/'를 기준으로 path와 path_last로 잘라서, 
 		*ptr_slash = '\0';
-		char* path_last = ptr_slash + 1;
-		ASSERT(path[0]!='\0');
-		// current_dir에서 path를 찾아 들어가고
+		// dir에서 path를 찾아 들어감
 		struct inode* inode = NULL;
-		if (!dir_lookup(current_dir, path, &inode) || inode==NULL) {
+		bool found = dir_lookup(dir, path, &inode);
+		if (dir!=current_dir) {
+			dir_close(dir);
+		}
+		if (!found || (dir = dir_open(inode))==NULL) {
+			free(path);
 			return false;
 		}
-		// 다시 call
-		return dir_parse(dir_open(inode), path_last, parsed_dir, name);
+		// name은 path_last를 path의 앞으로 옮겨서 돌려줌
+		memmove(path, ptr_slash + 1, strlen(ptr_slash + 1) + 1);
 	}
-	*parsed_dir = current_dir;
+	*parsed_dir = dir;
 	*name = path;
 	return true;
+
+fail:
+	if (dir!=NULL && dir!=current_dir) {
+		dir_close(dir);
+	}
+	return false;
 }
 
 // dir이 remove되었는지 확인함
@@ -128,6 +147,234 @@ dir_get_inode (struct dir *dir) {
 	return dir->inode;
 }
 
+#ifdef EFILESYS
+/* Hash index of a directory.
+ *
+ * A directory is a plain array of entries. Once it has DIR_INDEX_MIN
+ * entries, it also gets a hash index in a file of its own, so that
+ * finding a name no longer reads the whole directory. The index is an
+ * open addressing hash table of names: a header, then CAP slots, each
+ * holding the number of an entry plus 1, 0 if the slot was never used,
+ * or DIR_INDEX_TOMB if its entry was removed. Smaller directories have
+ * no index and are searched from start to end as before. */
+
+/* Number of entries at which a directory gets a hash index. */
+#define DIR_INDEX_MIN 32
+
+/* Fewest slots in an index. */
+#define DIR_INDEX_CAP_MIN 128
+
+/* Slot of a removed entry. */
+#define DIR_INDEX_TOMB UINT32_MAX
+
+/* Header of a hash index. */
+struct dir_index_head {
+	uint32_t cap;                       /* Number of slots, a power of 2. */
+	uint32_t used;                      /* Slots in use or removed. */
+	uint32_t live;                      /* Slots in use. */
+	uint32_t free_hint;                 /* No free entry comes before it. */
+};
+
+/* Returns the hash index of DIR, or NULL if it has none. */
+static struct inode *
+dir_index (const struct dir *dir) {
+	struct inode *inode = dir->inode;
+
+	if (inode->index == NULL && !inode_is_inline (inode)
+			&& inode->data.index != 0)
+		inode->index = inode_open (inode->data.index);
+	return inode->index;
+}
+
+static bool
+dir_index_get (struct inode *index, uint32_t slot, uint32_t *val) {
+	return inode_read_at (index, val, sizeof *val,
+			sizeof (struct dir_index_head) + slot * sizeof *val) == sizeof *val;
+}
+
+static bool
+dir_index_set (struct inode *index, uint32_t slot, uint32_t val) {
+	return inode_write_at (index, &val, sizeof val,
+			sizeof (struct dir_index_head) + slot * sizeof val) == sizeof val;
+}
+
+/* Searches the hash index INDEX of DIR for NAME. If it is there, returns
+ * true and stores its slot in *SLOTP, its entry in *EP and the offset of
+ * its entry in *OFSP. Otherwise, returns false and stores in *SLOTP the
+ * slot to put it in, or DIR_INDEX_TOMB if the index is full. EP and OFSP
+ * may be null. */
+static bool
+dir_index_find (const struct dir *dir, struct inode *index, const char *name,
+		uint32_t *slotp, struct dir_entry *ep, off_t *ofsp) {
+	struct dir_index_head head;
+	struct dir_entry e;
+	uint32_t slot, val, n;
+
+	*slotp = DIR_INDEX_TOMB;
+	if (inode_read_at (index, &head, sizeof head, 0) != sizeof head)
+		return false;
+	slot = hash_string (name) & (head.cap - 1);
+	for (n = 0; n < head.cap; n++, slot = (slot + 1) & (head.cap - 1)) {
+		if (!dir_index_get (index, slot, &val))
+			return false;
+		if (val == 0 || val == DIR_INDEX_TOMB) {
+			if (*slotp == DIR_INDEX_TOMB)
+				*slotp = slot;
+			if (val == 0)
+				return false;
+			continue;
+		}
+		off_t ofs = (val - 1) * sizeof e;
+		if (inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e
+				&& e.in_use && !strcmp (name, e.name)) {
+			*slotp = slot;
+			if (ep != NULL)
+				*ep = e;
+			if (ofsp != NULL)
+				*ofsp = ofs;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Rebuilds the hash index INDEX of DIR from the entries of DIR, with
+ * at least four times as many slots as it has entries, and without the
+ * removed ones. Returns true if successful. */
+static bool
+dir_index_build (struct dir *dir, struct inode *index) {
+	static uint32_t zeros[DISK_SECTOR_SIZE / sizeof (uint32_t)];
+	struct dir_index_head head = { DIR_INDEX_CAP_MIN, 0, 0, UINT32_MAX };
+	struct dir_entry e;
+	uint32_t idx, slot, val;
+	off_t ofs, size;
+
+	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+			ofs += sizeof e)
+		if (e.in_use)
+			head.live++;
+	while (head.cap < head.live * 4)
+		head.cap *= 2;
+
+	/* Clear the slots. */
+	size = head.cap * sizeof val;
+	for (ofs = 0; ofs < size; ofs += sizeof zeros)
+		if (inode_write_at (index, zeros, size - ofs < (off_t) sizeof zeros
+					? size - ofs : (off_t) sizeof zeros,
+					sizeof head + ofs) <= 0)
+			return false;
+
+	/* Put every entry in. */
+	for (idx = 0; inode_read_at (dir->inode, &e, sizeof e, idx * sizeof e)
+			== sizeof e; idx++) {
+		if (!e.in_use) {
+			if (head.free_hint == UINT32_MAX)
+				head.free_hint = idx;
+			continue;
+		}
+		slot = hash_string (e.name) & (head.cap - 1);
+		for (;;) {
+			if (!dir_index_get (index, slot, &val))
+				return false;
+			if (val == 0)
+				break;
+			slot = (slot + 1) & (head.cap - 1);
+		}
+		if (!dir_index_set (index, slot, idx + 1))
+			return false;
+		head.used++;
+	}
+	if (head.free_hint == UINT32_MAX)
+		head.free_hint = idx;
+	return inode_write_at (index, &head, sizeof head, 0) == sizeof head;
+}
+
+/* Gives DIR a hash index. Leaves DIR without one if that fails. */
+static void
+dir_index_create (struct dir *dir) {
+	struct inode *inode = dir->inode;
+	struct inode *index;
+	cluster_t clst = fat_create_chain (0);
+
+	if (clst == 0)
+		return;
+	if (!inode_create (cluster_to_sector (clst), 0, NULL, INODE_FILE)) {
+		fat_remove_chain (clst, 0);
+		return;
+	}
+	index = inode_open (cluster_to_sector (clst));
+	if (index == NULL)
+		return;
+	if (!dir_index_build (dir, index)) {
+		inode_remove (index);
+		inode_close (index);
+		return;
+	}
+	inode->index = index;
+	inode->data.index = cluster_to_sector (clst);
+	inode->dirty = true;
+}
+
+/* Adds an entry for NAME, whose inode is at INODE_SECTOR, to DIR, which
+ * has the hash index INDEX. Returns true if successful. */
+static bool
+dir_index_add (struct dir *dir, struct inode *index, const char *name,
+		disk_sector_t inode_sector) {
+	struct dir_index_head head;
+	struct dir_entry e;
+	uint32_t slot, val, idx;
+
+	for (bool rebuilt = false;; rebuilt = true) {
+		if (dir_index_find (dir, index, name, &slot, NULL, NULL))
+			return false;
+		if (inode_read_at (index, &head, sizeof head, 0) != sizeof head)
+			return false;
+		if (slot != DIR_INDEX_TOMB && (head.used + 1) * 2 <= head.cap)
+			break;
+		/* A rebuilt index has room and no tombstones, so needing a
+		 * second rebuild means it cannot be read. */
+		if (rebuilt || !dir_index_build (dir, index))
+			return false;
+	}
+
+	/* Take the first free entry. */
+	for (idx = head.free_hint; inode_read_at (dir->inode, &e, sizeof e,
+				idx * sizeof e) == sizeof e; idx++)
+		if (!e.in_use)
+			break;
+	e.in_use = true;
+	strlcpy (e.name, name, sizeof e.name);
+	e.inode_sector = inode_sector;
+	if (inode_write_at (dir->inode, &e, sizeof e, idx * sizeof e) != sizeof e)
+		return false;
+
+	if (!dir_index_get (index, slot, &val) || !dir_index_set (index, slot, idx + 1))
+		return false;
+	if (val == 0)
+		head.used++;
+	head.live++;
+	head.free_hint = idx + 1;
+	return inode_write_at (index, &head, sizeof head, 0) == sizeof head;
+}
+
+/* Drops NAME, whose entry is at OFS in DIR, from the hash index INDEX. */
+static void
+dir_index_remove (struct dir *dir, struct inode *index, const char *name,
+		off_t ofs) {
+	struct dir_index_head head;
+	uint32_t slot;
+
+	if (!dir_index_find (dir, index, name, &slot, NULL, NULL)
+			|| inode_read_at (index, &head, sizeof head, 0) != sizeof head)
+		return;
+	dir_index_set (index, slot, DIR_INDEX_TOMB);
+	head.live--;
+	if (head.free_hint > ofs / sizeof (struct dir_entry))
+		head.free_hint = ofs / sizeof (struct dir_entry);
+	inode_write_at (index, &head, sizeof head, 0);
+}
+#endif
+
 /* Searches DIR for a file with the given NAME.
  * If successful, returns true, sets *EP to the directory entry
  * if EP is non-null, and sets *OFSP to the byte offset of the
@@ -142,6 +389,14 @@ lookup (const struct dir *dir, const char *name,
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
+#ifdef EFILESYS
+	struct inode *index = dir_index (dir);
+	if (index != NULL) {
+		uint32_t slot;
+		return dir_index_find (dir, index, name, &slot, ep, ofsp);
+	}
+#endif
+
 	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 			ofs += sizeof e)
 		if (e.in_use && !strcmp (name, e.name)) {
@@ -154,66 +409,240 @@ lookup (const struct dir *dir, const char *name,
 	return false;
 }
 
+#ifdef EFILESYS
+/* Dentry cache.
+ *
+ * Maps a name in a directory, given by the directory's sector, to the
+ * sector of the inode it names, or to 0 if the directory has no such
+ * name, so that resolving a path that was resolved lately reads no
+ * directory at all. Entries come from a fixed pool and the least
+ * recently used one is reused when it runs out. dir_add() and
+ * dir_remove() keep the entries of a directory up to date, and
+ * dir_forget() drops them once the directory is gone. */
+
+/* Number of entries in the dentry cache. */
+#define DCACHE_SIZE 512
+
+struct dentry {
+	struct hash_elem elem;              /* Element in dcache. */
+	struct list_elem lru_elem;          /* Element in dcache_lru. */
+	disk_sector_t parent;               /* Sector of the directory. */
+	disk_sector_t sector;               /* Sector of the inode, or 0. */
+	char name[NAME_MAX + 1];            /* Null terminated file name. */
+};
+
+static struct dentry dentries[DCACHE_SIZE];
+static struct hash dcache;
+static struct list dcache_lru;          /* Most recently used first. */
+static struct lock dcache_lock;
+
+static uint64_t
+dentry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct dentry *d = hash_entry (e, struct dentry, elem);
+	return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct dentry *a = hash_entry (a_, struct dentry, elem);
+	const struct dentry *b = hash_entry (b_, struct dentry, elem);
+	if (a->parent != b->parent)
+		return a->parent < b->parent;
+	return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void) {
+	hash_init (&dcache, dentry_hash, dentry_less, NULL);
+	list_init (&dcache_lru);
+	lock_init (&dcache_lock);
+	for (size_t i = 0; i < DCACHE_SIZE; i++)
+		list_push_back (&dcache_lru, &dentries[i].lru_elem);
+}
+
+/* Returns the entry for NAME in the directory at PARENT, or NULL if
+ * there is none. Must be called with dcache_lock held. */
+static struct dentry *
+dcache_find (disk_sector_t parent, const char *name) {
+	struct dentry key;
+	struct hash_elem *e;
+
+	key.parent = parent;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&dcache, &key.elem);
+	return e != NULL ? hash_entry (e, struct dentry, elem) : NULL;
+}
+
+/* Looks up NAME in the directory at PARENT in the dentry cache. If it
+ * is there, returns true and stores the sector it names, or 0 if the
+ * directory has no such name, in *SECTOR. */
+static bool
+dcache_lookup (disk_sector_t parent, const char *name, disk_sector_t *sector) {
+	struct dentry *d;
+
+	lock_acquire (&dcache_lock);
+	d = dcache_find (parent, name);
+	if (d != NULL) {
+		*sector = d->sector;
+		list_remove (&d->lru_elem);
+		list_push_front (&dcache_lru, &d->lru_elem);
+	}
+	lock_release (&dcache_lock);
+	return d != NULL;
+}
+
+/* Records in the dentry cache that NAME in the directory at PARENT names
+ * the inode at SECTOR, or nothing if SECTOR is 0. */
+static void
+dcache_set (disk_sector_t parent, const char *name, disk_sector_t sector) {
+	struct dentry *d;
+
+	lock_acquire (&dcache_lock);
+	d = dcache_find (parent, name);
+	if (d == NULL) {
+		d = list_entry (list_back (&dcache_lru), struct dentry, lru_elem);
+		if (d->parent != 0)
+			hash_delete (&dcache, &d->elem);
+		d->parent = parent;
+		strlcpy (d->name, name, sizeof d->name);
+		hash_insert (&dcache, &d->elem);
+	}
+	d->sector = sector;
+	list_remove (&d->lru_elem);
+	list_push_front (&dcache_lru, &d->lru_elem);
+	lock_release (&dcache_lock);
+}
+
+/* Drops the entries of the directory at SECTOR from the dentry cache,
+ * because the directory is gone and SECTOR may be reused. */
+void
+dir_forget (disk_sector_t sector) {
+	lock_acquire (&dcache_lock);
+	for (size_t i = 0; i < DCACHE_SIZE; i++) {
+		struct dentry *d = &dentries[i];
+		if (d->parent == sector) {
+			hash_delete (&dcache, &d->elem);
+			d->parent = 0;
+			list_remove (&d->lru_elem);
+			list_push_back (&dcache_lru, &d->lru_elem);
+		}
+	}
+	lock_release (&dcache_lock);
+}
+#endif
+
+/* Searches DIR for NAME, a single file name, and returns true and stores
+ * the sector of its inode in *SECTOR if it is there. Must be called with
+ * DIR's dir_lock held, so that the answer cached is still true. */
+static bool
+dir_lookup_locked (const struct dir *dir, const char *name,
+		disk_sector_t *sector) {
+	struct dir_entry e;
+	bool found;
+
+#ifdef EFILESYS
+	if (dcache_lookup (dir->inode->sector, name, sector))
+		return *sector != 0;
+#endif
+	found = lookup (dir, name, &e, NULL);
+	if (found)
+		*sector = e.inode_sector;
+#ifdef EFILESYS
+	dcache_set (dir->inode->sector, name, found ? e.inode_sector : 0);
+#endif
+	return found;
+}
+
+/* Searches DIR for NAME, a single file name, and returns true and stores
+ * the sector of its inode in *SECTOR if it is there. Only a miss in the
+ * dentry cache waits for changes to DIR. */
+static bool
+dir_lookup_sector (const struct dir *dir, const char *name,
+		disk_sector_t *sector) {
+	bool found;
+
+#ifdef EFILESYS
+	if (dcache_lookup (dir->inode->sector, name, sector))
+		return *sector != 0;
+#endif
+	lock_acquire (&dir->inode->dir_lock);
+	found = dir_lookup_locked (dir, name, sector);
+	lock_release (&dir->inode->dir_lock);
+	return found;
+}
+
 /* Searches DIR for a file with the given NAME
  * and returns true if one exists, false otherwise.
  * On success, sets *INODE to an inode for the file, otherwise to
- * a null pointer.  The caller must close *INODE. */
+ * a null pointer.  The caller must close *INODE.
+ * NAME may be a path, relative to DIR unless it starts with `/'. It is
+ * resolved a file name at a time, following links, without copying it
+ * or opening more than one directory at a time. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
-	struct dir_entry e;
+	char part[NAME_MAX + 1];
+	struct inode *cur;
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 	if (name[0]=='\0') {
 		*inode = dir->inode;
 		return *inode!=NULL;
 	}
-	// name is "/" or "/~"
-	if (name[0]=='/') {
-		return dir_lookup(dir_open_root(), name+1, inode);
-	}
 
-	// char name_first[PATH_MAX];
-	char* name_first = malloc(sizeof(char)*PATH_MAX); // free on where ????
-	strlcpy(name_first, name, strlen(name)+1);
-
-	if (name_first[strlen(name_first)-1]=='/') {
-		name_first[strlen(name_first)-1] ='\0';
-		return dir_lookup(dir, name_first, inode);
-	}
-
-	char* ptr_slash = strchr(name_first, '/');
+	*inode = NULL;
+	if (name[0]=='/')
+		cur = inode_open (
+#ifdef EFILESYS
+				cluster_to_sector (ROOT_DIR_CLUSTER)
+#else
+				ROOT_DIR_SECTOR
+#endif
+				);
+	else
+		cur = inode_reopen (dir->inode);
+
+	for (;;) {
+		struct dir parent = { cur, 0 };
+		struct inode *child;
+		disk_sector_t sector;
+		size_t len;
+
+		while (*name == '/')
+			name++;
+		if (*name == '\0')
+			break;
+		len = strcspn (name, "/");
+		if (len > NAME_MAX) {
+			inode_close (cur);
+			return false;
+		}
+		memcpy (part, name, len);
+		part[len] = '\0';
+		name += len;
 
-	if (ptr_slash==NULL) {
-		if (!lookup (dir, name_first, &e, NULL)) {
-			*inode = NULL; // necessary?
+		if (cur == NULL || !dir_lookup_sector (&parent, part, &sector)
+				|| (child = inode_open (sector)) == NULL) {
+			inode_close (cur);
 			return false;
 		}
-		ASSERT(e.in_use);
-		*inode = inode_open (e.inode_sector);
-		if ((*inode)->data.type==INODE_LINK) {
-			return dir_lookup(dir, (*inode)->data.target, inode);
+		if (child->data.type==INODE_LINK) {
+			struct inode *target;
+			bool found = dir_lookup (&parent, child->data.target, &target);
+			inode_close (child);
+			if (!found) {
+				inode_close (cur);
+				return false;
+			}
+			child = target;
 		}
-		return *inode != NULL;
+		inode_close (cur);
+		cur = child;
 	}
-
-	*ptr_slash = '\0';
-	char* name_last = ptr_slash + 1;
-	
-	// name is "a" or "a/"
-
-	ASSERT(name_first[0]!='\0');
-
-	// name is "a/b"
-	struct inode *inode_child = NULL;
-	if (!dir_lookup (dir, name_first, &inode_child)) {
-		return false;
-	}
-	struct dir* dir_child;
-	if (!(dir_child = dir_open(inode_child))) {
-		return false;
-	}
-	return dir_lookup(dir_child, name_last, inode);
+	*inode = cur;
+	return cur != NULL;
 }
 
 /* Adds a file named NAME to DIR, which must not already contain a
@@ -235,8 +664,20 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 		return false;
 	}
 
+	lock_acquire (&dir->inode->dir_lock);
+#ifdef EFILESYS
+	struct inode *index = dir_index (dir);
+	if (index != NULL) {
+		success = dir_index_add (dir, index, name, inode_sector);
+		if (success)
+			dcache_set (dir->inode->sector, name, inode_sector);
+		goto done;
+	}
+#endif
+
 	/* Check that NAME is not in use. */
-	if (lookup (dir, name, NULL, NULL))
+	disk_sector_t sector;
+	if (dir_lookup_locked (dir, name, &sector))
 		goto done;
 	/* Set OFS to offset of free slot.
 	 * If there are no free slots, then it will be set to the
@@ -254,8 +695,15 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	strlcpy (e.name, name, sizeof e.name);
 	e.inode_sector = inode_sector;
 	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+#ifdef EFILESYS
+	if (success && ofs / (off_t) sizeof e + 1 >= DIR_INDEX_MIN)
+		dir_index_create (dir);
+	if (success)
+		dcache_set (dir->inode->sector, name, inode_sector);
+#endif
 
 done:
+	lock_release (&dir->inode->dir_lock);
 	return success;
 }
 
@@ -272,6 +720,7 @@ dir_remove (struct dir *dir, const char *name) {
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
+	lock_acquire (&dir->inode->dir_lock);
 	/* Find directory entry. */
 	if (!lookup (dir, name, &e, &ofs))
 		goto done;
@@ -294,15 +743,25 @@ dir_remove (struct dir *dir, const char *name) {
 	
 
 	/* Erase directory entry. */
+#ifdef EFILESYS
+	struct inode *index = dir_index (dir);
+	if (index != NULL)
+		dir_index_remove (dir, index, name, ofs);
+#endif
 	e.in_use = false;
 	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
 		goto done;
 
+#ifdef EFILESYS
+	dcache_set (dir->inode->sector, name, 0);
+#endif
+
 	/* Remove inode. */
 	inode_remove (inode);
 	success = true;
 
 done:
+	lock_release (&dir->inode->dir_lock);
 	inode_close (inode);
 	return success;
 }
@@ -3,19 +3,31 @@
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include <bitmap.h>
+#include <limits.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 
 /* Should be less than DISK_SECTOR_SIZE */
 struct fat_boot {
 	unsigned int magic;
-	unsigned int sectors_per_cluster; /* Fixed to 1 */
+	unsigned int sectors_per_cluster; /* Chosen at format time. */
 	unsigned int total_sectors;
 	unsigned int fat_start;
 	unsigned int fat_sectors; /* Size of FAT in sectors. */
 	unsigned int root_dir_cluster;
 };
 
+typedef unsigned long free_word_t;
+#define FREE_WORD_BITS (sizeof (free_word_t) * CHAR_BIT)
+
+/* Number of FAT entries in a sector of the FAT. */
+#define FAT_ENTRIES_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (cluster_t))
+
+/* Most FAT sectors written in one disk request. */
+#define FAT_WRITE_BATCH 32
+
 /* FAT FS */
 struct fat_fs {
 	struct fat_boot bs;
@@ -23,13 +35,34 @@ struct fat_fs {
 	unsigned int fat_length;
 	disk_sector_t data_start;
 	cluster_t last_clst;
-	struct lock write_lock;
+	struct lock write_lock;     /* Serializes writing the FAT out. */
+	struct lock alloc_lock;     /* Serializes taking free clusters, from
+	                               finding one to putting it in use. */
+
+	/* The FAT is read in a sector at a time, the first time a sector is
+	 * touched, and written back a sector at a time. */
+	struct lock load_lock;      /* Guards loading and free_cnt. */
+	struct bitmap *loaded;      /* One bit per FAT sector, set if read in. */
+	struct bitmap *dirty;       /* One bit per FAT sector, set if changed. */
+	size_t load_cursor;         /* No sector before it is still unread. */
+
+	/* Free cluster index, kept in step with the FAT by fat_put(). */
+	free_word_t *free_map;      /* One bit per cluster, set if free. */
+	size_t free_cnt;            /* Number of free clusters. */
+	cluster_t cursor;           /* Where the next search starts. */
 };
 
 static struct fat_fs *fat_fs;
 
+unsigned fat_format_sectors_per_cluster = SECTORS_PER_CLUSTER;
+
 void fat_boot_create (void);
 void fat_fs_init (void);
+static void fat_alloc (void);
+static void fat_load (size_t sec);
+static void fat_touch (cluster_t clst);
+static void fat_free_map_init (void);
+static void fat_free_map_set (cluster_t clst, bool free_);
 
 void
 fat_init (void) {
@@ -49,35 +82,82 @@ fat_init (void) {
 	if (fat_fs->bs.magic != FAT_MAGIC)
 		fat_boot_create ();
 	fat_fs_init ();
+	lock_init (&fat_fs->write_lock);
+	lock_init (&fat_fs->alloc_lock);
+	lock_init (&fat_fs->load_lock);
 }
 
+/* Allocates the in-memory FAT, with room for whole sectors, and the
+ * bitmaps that go with it. */
+static void
+fat_alloc (void) {
+	size_t words = DIV_ROUND_UP (fat_fs->fat_length, FREE_WORD_BITS);
+
+	fat_fs->fat = calloc (fat_fs->bs.fat_sectors, DISK_SECTOR_SIZE);
+	fat_fs->loaded = bitmap_create (fat_fs->bs.fat_sectors);
+	fat_fs->dirty = bitmap_create (fat_fs->bs.fat_sectors);
+	fat_fs->free_map = calloc (words, sizeof (free_word_t));
+	if (fat_fs->fat == NULL || fat_fs->loaded == NULL || fat_fs->dirty == NULL
+			|| fat_fs->free_map == NULL)
+		PANIC ("FAT allocation failed");
+	fat_fs->free_cnt = 0;
+	fat_fs->cursor = 1;
+	fat_fs->load_cursor = 0;
+}
+
+/* Nothing is read here: each sector of the FAT is read in by fat_load()
+ * when it is first needed, so mounting takes the same time whatever the
+ * size of the disk. */
 void
 fat_open (void) {
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat == NULL)
-		PANIC ("FAT load failed");
-
-	// Load FAT directly from the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_read = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_read;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i,
-			           buffer + bytes_read);
-			bytes_read += DISK_SECTOR_SIZE;
-		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			memcpy (buffer + bytes_read, bounce, bytes_left);
-			bytes_read += bytes_left;
-			free (bounce);
-		}
-	}
+	fat_alloc ();
+}
+
+/* Reads sector SEC of the FAT in, unless it is in already, and adds its
+ * free clusters to the free cluster index. The caller must hold
+ * load_lock. */
+static void
+fat_load (size_t sec) {
+	cluster_t clst, end;
+
+	ASSERT (lock_held_by_current_thread (&fat_fs->load_lock));
+	if (bitmap_test (fat_fs->loaded, sec))
+		return;
+	disk_read (filesys_disk, fat_fs->bs.fat_start + sec,
+			fat_fs->fat + sec * FAT_ENTRIES_PER_SECTOR);
+	end = (sec + 1) * FAT_ENTRIES_PER_SECTOR;
+	if (end > fat_fs->fat_length)
+		end = fat_fs->fat_length;
+	for (clst = sec * FAT_ENTRIES_PER_SECTOR; clst < end; clst++)
+		if (clst != 0 && fat_fs->fat[clst] == 0)
+			fat_free_map_set (clst, true);
+	bitmap_mark (fat_fs->loaded, sec);
+	while (fat_fs->load_cursor < fat_fs->bs.fat_sectors
+			&& bitmap_test (fat_fs->loaded, fat_fs->load_cursor))
+		fat_fs->load_cursor++;
+}
+
+/* Makes sure the FAT sector that holds CLST's entry is read in. */
+static void
+fat_touch (cluster_t clst) {
+	size_t sec = clst / FAT_ENTRIES_PER_SECTOR;
+
+	if (bitmap_test (fat_fs->loaded, sec))
+		return;
+	lock_acquire (&fat_fs->load_lock);
+	fat_load (sec);
+	lock_release (&fat_fs->load_lock);
+}
+
+/* Reads in FAT sectors until at least NEED free clusters are known, or
+ * the whole FAT is in. */
+static void
+fat_load_free (size_t need) {
+	lock_acquire (&fat_fs->load_lock);
+	while (fat_fs->free_cnt < need
+			&& fat_fs->load_cursor < fat_fs->bs.fat_sectors)
+		fat_load (fat_fs->load_cursor);
+	lock_release (&fat_fs->load_lock);
 }
 
 void
@@ -90,27 +170,60 @@ fat_close (void) {
 	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
 	free (bounce);
 
-	// Write FAT directly to the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
+	fat_flush ();
+}
+
+/* Writes the sectors of the FAT that changed since they were last
+ * written out, runs of adjacent ones in one request, so that the disk
+ * does not depend on fat_close() alone. */
+void
+fat_flush (void) {
+	const void *buffers[FAT_WRITE_BATCH];
+	size_t sec = 0, cnt;
+
+	lock_acquire (&fat_fs->write_lock);
+	while ((sec = bitmap_scan (fat_fs->dirty, sec, 1, true)) != BITMAP_ERROR) {
+		for (cnt = 0; cnt < FAT_WRITE_BATCH
+				&& sec + cnt < fat_fs->bs.fat_sectors
+				&& bitmap_test (fat_fs->dirty, sec + cnt); cnt++) {
+			/* Cleared first: a change made while writing marks it again. */
+			bitmap_reset (fat_fs->dirty, sec + cnt);
+			buffers[cnt] = fat_fs->fat + (sec + cnt) * FAT_ENTRIES_PER_SECTOR;
 		}
+		disk_write_multiple (filesys_disk, fat_fs->bs.fat_start + sec, cnt,
+				buffers);
+		sec += cnt;
 	}
+	lock_release (&fat_fs->write_lock);
+}
+
+/* Writes the dirty FAT sectors that hold entries of the chain starting
+ * at CLST, and no others, back to disk. */
+void
+fat_flush_chain (cluster_t clst) {
+	const void *buffers[FAT_WRITE_BATCH];
+	size_t first = 0, cnt = 0;
+
+	lock_acquire (&fat_fs->write_lock);
+	for (; clst != 0 && clst != EOChain; clst = fat_get (clst)) {
+		size_t sec = clst / FAT_ENTRIES_PER_SECTOR;
+		if (!bitmap_test (fat_fs->dirty, sec))
+			continue;
+		/* Sectors next to each other go out in one request. */
+		if (cnt > 0 && (sec != first + cnt || cnt == FAT_WRITE_BATCH)) {
+			disk_write_multiple (filesys_disk, fat_fs->bs.fat_start + first,
+					cnt, buffers);
+			cnt = 0;
+		}
+		if (cnt == 0)
+			first = sec;
+		bitmap_reset (fat_fs->dirty, sec);
+		buffers[cnt++] = fat_fs->fat + sec * FAT_ENTRIES_PER_SECTOR;
+	}
+	if (cnt > 0)
+		disk_write_multiple (filesys_disk, fat_fs->bs.fat_start + first, cnt,
+				buffers);
+	lock_release (&fat_fs->write_lock);
 }
 
 void
@@ -119,10 +232,13 @@ fat_create (void) {
 	fat_boot_create ();
 	fat_fs_init ();
 
-	// Create FAT table
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat == NULL)
-		PANIC ("FAT creation failed");
+	// Create FAT table, all of it to be written out.
+	fat_alloc ();
+	bitmap_set_all (fat_fs->loaded, true);
+	bitmap_set_all (fat_fs->dirty, true);
+	fat_fs->load_cursor = fat_fs->bs.fat_sectors;
+
+	fat_free_map_init ();
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
@@ -137,12 +253,13 @@ fat_create (void) {
 
 void
 fat_boot_create (void) {
+	unsigned int spc = fat_format_sectors_per_cluster;
 	unsigned int fat_sectors =
 	    (disk_size (filesys_disk) - 1)
-	    / (DISK_SECTOR_SIZE / sizeof (cluster_t) * SECTORS_PER_CLUSTER + 1) + 1;
+	    / (DISK_SECTOR_SIZE / sizeof (cluster_t) * spc + 1) + 1;
 	fat_fs->bs = (struct fat_boot){
 	    .magic = FAT_MAGIC,
-	    .sectors_per_cluster = SECTORS_PER_CLUSTER,
+	    .sectors_per_cluster = spc,
 	    .total_sectors = disk_size (filesys_disk),
 	    .fat_start = 1,
 	    .fat_sectors = fat_sectors,
@@ -154,61 +271,212 @@ void
 fat_fs_init (void) {
 	/* TODO: Your code goes here. */
 	// fat_fs->fat_length = fat_fs->bs.fat_sectors * DISK_SECTOR_SIZE / (sizeof(cluster_t) * SECTORS_PER_CLUSTER);
-	fat_fs->fat_length = (fat_fs->bs.total_sectors - fat_fs->bs.fat_sectors) / SECTORS_PER_CLUSTER;
 	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors; // in sectors
+	fat_fs->fat_length = (fat_fs->bs.total_sectors - fat_fs->data_start) / fat_fs->bs.sectors_per_cluster;
 }
 
 /*----------------------------------------------------------------------------*/
-/* FAT handling                                                               */
+/* Free cluster index                                                         */
 /*----------------------------------------------------------------------------*/
 
-cluster_t fat_find_empty() {
-	cluster_t i = 1;
-	while(i < fat_fs->fat_length) {
-		if (fat_get(i)==0) {
-			return i;
+/* Builds the free cluster index from a FAT that is all in memory.
+ * Cluster 0 is not a real cluster and is never free. */
+static void
+fat_free_map_init (void) {
+	for (cluster_t clst = 1; clst < fat_fs->fat_length; clst++)
+		if (fat_fs->fat[clst] == 0) {
+			fat_fs->free_map[clst / FREE_WORD_BITS] |=
+				(free_word_t) 1 << clst % FREE_WORD_BITS;
+			fat_fs->free_cnt++;
 		}
-		i++;
+	fat_fs->cursor = 1;
+}
+
+/* Marks CLST free or in use in the free cluster index. */
+static void
+fat_free_map_set (cluster_t clst, bool free_) {
+	free_word_t bit = (free_word_t) 1 << clst % FREE_WORD_BITS;
+	free_word_t *word = &fat_fs->free_map[clst / FREE_WORD_BITS];
+
+	if (free_ && !(*word & bit)) {
+		*word |= bit;
+		fat_fs->free_cnt++;
+	} else if (!free_ && (*word & bit)) {
+		*word &= ~bit;
+		fat_fs->free_cnt--;
 	}
-	return 0;
 }
 
-bool fat_enough_space(size_t need) {
-	cluster_t i = 1;
-	size_t num = 0;
-	while(i < fat_fs->fat_length) {
-		if (num >= need) {
-			return true;
-		}
-		if (fat_get(i)==0) {
-			num++;
+/* Returns true if CLST is free. */
+static bool
+fat_free_map_test (cluster_t clst) {
+	fat_touch (clst);
+	return fat_fs->free_map[clst / FREE_WORD_BITS]
+		& (free_word_t) 1 << clst % FREE_WORD_BITS;
+}
+
+/* Returns the first free cluster at or after START and before END, or 0
+ * if there is none. Skips a whole word of clusters in use at a time,
+ * reading in the FAT sectors it comes to. */
+static cluster_t
+fat_free_map_scan (cluster_t start, cluster_t end) {
+	size_t idx = start / FREE_WORD_BITS;
+	free_word_t word;
+
+	if (start >= end)
+		return 0;
+	/* Mask off the clusters before START in its word. */
+	fat_touch (idx * FREE_WORD_BITS);
+	word = fat_fs->free_map[idx] & ~(((free_word_t) 1 << start % FREE_WORD_BITS) - 1);
+	for (;;) {
+		if (word != 0) {
+			cluster_t clst = idx * FREE_WORD_BITS + __builtin_ctzl (word);
+			return clst < end ? clst : 0;
 		}
-		i++;
+		if (++idx * FREE_WORD_BITS >= end)
+			return 0;
+		fat_touch (idx * FREE_WORD_BITS);
+		word = fat_fs->free_map[idx];
 	}
-	return false;
+}
+
+/*----------------------------------------------------------------------------*/
+/* FAT handling                                                               */
+/*----------------------------------------------------------------------------*/
+
+/* Returns a free cluster, or 0 if the disk is full. The search starts
+ * where the last one stopped, so that it does not rescan the clusters
+ * filled since. The caller must hold alloc_lock until the cluster is
+ * put in use. */
+static cluster_t
+fat_find_free (void) {
+	cluster_t clst;
+
+	ASSERT (lock_held_by_current_thread (&fat_fs->alloc_lock));
+
+	if (fat_fs->free_cnt == 0 && fat_fs->load_cursor == fat_fs->bs.fat_sectors)
+		return 0;
+	clst = fat_free_map_scan (fat_fs->cursor, fat_fs->fat_length);
+	if (clst == 0)
+		clst = fat_free_map_scan (1, fat_fs->cursor);
+	if (clst != 0)
+		fat_fs->cursor = clst + 1;
+	return clst;
+}
+
+/* Returns a free cluster, or 0 if the disk is full. Another thread may
+ * take it before the caller does. */
+cluster_t fat_find_empty() {
+	cluster_t clst;
+
+	lock_acquire (&fat_fs->alloc_lock);
+	clst = fat_find_free ();
+	lock_release (&fat_fs->alloc_lock);
+	return clst;
+}
+
+/* Returns true if NEED clusters are free. Reads in only as much of the
+ * FAT as it takes to find them. */
+bool fat_enough_space(size_t need) {
+	fat_load_free (need);
+	return fat_fs->free_cnt >= need;
+}
+
+/* Returns the number of free clusters. Reads in the whole FAT. */
+size_t
+fat_free_cnt (void) {
+	fat_load_free (SIZE_MAX);
+	return fat_fs->free_cnt;
 }
 
 /* Add a cluster to the chain.
  * If CLST is 0, start a new chain.
- * Returns 0 if fails to allocate a new cluster. */
+ * Returns 0 if fails to allocate a new cluster.
+ * A chain goes on with the cluster right after CLST if it is free, or
+ * else with the nearest free one after it, so that files written at the
+ * same time do not end up interleaved. */
 cluster_t
 fat_create_chain (cluster_t clst) {
 	/* TODO: Your code goes here. */
-	cluster_t new = fat_find_empty();
+	cluster_t new = 0;
+	lock_acquire (&fat_fs->alloc_lock);
+	if (clst!=0) {
+		new = fat_free_map_scan(clst + 1, fat_fs->fat_length);
+	}
 	if (new==0) {
-		return 0;
+		new = fat_find_free();
+	}
+	if (new!=0) {
+		fat_link(clst, new);
 	}
+	lock_release (&fat_fs->alloc_lock);
+	return new;
+}
 
+/* Appends NEW, which must be free or reserved, to the chain ending at
+ * CLST. If CLST is 0, NEW starts a new chain. */
+void
+fat_link (cluster_t clst, cluster_t new) {
 	fat_put(new, EOChain);
 
 	if (clst!=0) {
 		ASSERT(fat_get(clst)==EOChain);
 		fat_put(clst, new);
 	}
+}
+
+/* Adds a cluster to a chain right after CLST, which need not be the end
+ * of it, and returns the cluster, or 0 if the disk is full. */
+cluster_t
+fat_insert (cluster_t clst) {
+	cluster_t new;
 
+	lock_acquire (&fat_fs->alloc_lock);
+	new = fat_free_map_scan (clst + 1, fat_fs->fat_length);
+	if (new == 0)
+		new = fat_find_free ();
+	if (new != 0) {
+		fat_put (new, fat_get (clst));
+		fat_put (clst, new);
+	}
+	lock_release (&fat_fs->alloc_lock);
 	return new;
 }
 
+/* Preallocates clusters for a chain that grows from CLST: takes up to
+ * CNT clusters from CLST + 1 on, as far as they are free, out of the free
+ * cluster index, and returns how many it took. They are not in any
+ * chain until fat_link() puts them there; fat_unreserve() gives back
+ * the ones left over. */
+size_t
+fat_reserve (cluster_t clst, size_t cnt) {
+	size_t i;
+
+	lock_acquire (&fat_fs->alloc_lock);
+	for (i = 0; i < cnt; i++) {
+		cluster_t next = clst + 1 + i;
+		if (next >= fat_fs->fat_length || !fat_free_map_test (next))
+			break;
+		lock_acquire (&fat_fs->load_lock);
+		fat_free_map_set (next, false);
+		lock_release (&fat_fs->load_lock);
+	}
+	lock_release (&fat_fs->alloc_lock);
+	return i;
+}
+
+/* Returns the CNT clusters from CLST on, reserved by fat_reserve(), to
+ * the free cluster index, except those that were linked since. */
+void
+fat_unreserve (cluster_t clst, size_t cnt) {
+	for (; cnt > 0; clst++, cnt--)
+		if (fat_get (clst) == 0) {
+			lock_acquire (&fat_fs->load_lock);
+			fat_free_map_set (clst, true);
+			lock_release (&fat_fs->load_lock);
+		}
+}
+
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
@@ -232,13 +500,19 @@ fat_remove_chain (cluster_t clst, cluster_t pclst) {
 void
 fat_put (cluster_t clst, cluster_t val) {
 	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->load_lock);
+	fat_load (clst / FAT_ENTRIES_PER_SECTOR);
 	fat_fs->fat[clst] = val;
+	bitmap_mark (fat_fs->dirty, clst / FAT_ENTRIES_PER_SECTOR);
+	fat_free_map_set (clst, val == 0);
+	lock_release (&fat_fs->load_lock);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
 	/* TODO: Your code goes here. */
+	fat_touch (clst);
 	return fat_fs->fat[clst];
 }
 
@@ -246,10 +520,30 @@ fat_get (cluster_t clst) {
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
 	/* TODO: Your code goes here. */
-	return fat_fs->data_start + clst * SECTORS_PER_CLUSTER;
+	return fat_fs->data_start + clst * fat_fs->bs.sectors_per_cluster;
 }
 
 cluster_t
 sector_to_cluster (disk_sector_t sect) {
-	return (sect - fat_fs->data_start) / SECTORS_PER_CLUSTER;
+	return (sect - fat_fs->data_start) / fat_fs->bs.sectors_per_cluster;
+}
+
+/* Returns the number of sectors in a cluster. */
+unsigned
+fat_sectors_per_cluster (void) {
+	return fat_fs->bs.sectors_per_cluster;
+}
+
+/* Returns the size of a cluster in bytes. */
+size_t
+fat_cluster_size (void) {
+	return fat_fs->bs.sectors_per_cluster * DISK_SECTOR_SIZE;
+}
+
+/* Returns the number of bytes of memory the FAT takes. */
+size_t
+fat_footprint (void) {
+	return fat_fs->bs.fat_sectors * DISK_SECTOR_SIZE
+		+ DIV_ROUND_UP (fat_fs->fat_length, FREE_WORD_BITS) * sizeof (free_word_t)
+		+ 2 * bitmap_buf_size (fat_fs->bs.fat_sectors);
 }
\ No newline at end of file
@@ -63,6 +63,7 @@ file_get_inode (struct file *file) {
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
+	inode_readahead (file->inode, &file->ra, size, file->pos);
 	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
 	file->pos += bytes_read;
 	return bytes_read;
@@ -75,6 +76,7 @@ file_read (struct file *file, void *buffer, off_t size) {
  * The file's current position is unaffected. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
+	inode_readahead (file->inode, &file->ra, size, file_ofs);
 	return inode_read_at (file->inode, buffer, size, file_ofs);
 }
 
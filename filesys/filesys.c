@@ -7,6 +7,9 @@
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "devices/disk.h"
+#ifdef EFILESYS
+#include "vm/vm.h"
+#endif
 
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
@@ -22,6 +25,7 @@ filesys_init (bool format) {
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
 	inode_init ();
+	dir_init ();
 
 #ifdef EFILESYS
 	fat_init ();
@@ -50,6 +54,7 @@ void
 filesys_done (void) {
 	/* Original FS */
 #ifdef EFILESYS
+	page_cache_flush ();
 	fat_close ();
 #else
 	free_map_close ();
@@ -1,5 +1,6 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <random.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,8 +8,14 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "devices/disk.h"
+#include "devices/timer.h"
+#ifdef EFILESYS
+#include "filesys/fat.h"
+#endif
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* List files in the root directory. */
@@ -187,3 +194,427 @@ fsutil_get (char **argv) {
 	file_close (src);
 	free (buffer);
 }
+
+/* Returns SIZE, or the bytes that half the free clusters hold if that
+ * is less, so that a benchmark file leaves room on a small disk. */
+static off_t
+bench_clamp_size (off_t size) {
+#ifdef EFILESYS
+	if ((size_t) size / fat_cluster_size () > fat_free_cnt () / 2)
+		size = fat_free_cnt () / 2 * fat_cluster_size ();
+#endif
+	return size;
+}
+
+/* Prints that CNT operations, described by WHAT, took TICKS, and the
+ * time per operation, described by EACH. */
+static void
+bench_print_per_op (long long cnt, const char *what, int64_t ticks,
+		const char *each) {
+	printf ("%lld %s in %"PRId64" ticks, %"PRId64" ns per %s.\n",
+			cnt, what, ticks,
+			cnt > 0 ? ticks * (1000000000 / TIMER_FREQ) / cnt : 0, each);
+}
+
+/* Benchmarks the cluster allocator: fills all free clusters of the file
+ * system disk with one cluster chain, prints the time it took, and frees
+ * the chain again. */
+void
+fsutil_fat_bench (char **argv UNUSED) {
+#ifdef EFILESYS
+	cluster_t first = 0, last = 0;
+	size_t cnt = 0;
+	int64_t start, ticks;
+
+	printf ("Allocating %zu free clusters...\n", fat_free_cnt ());
+	start = timer_ticks ();
+	for (;;) {
+		cluster_t clst = fat_create_chain (last);
+		if (clst == 0)
+			break;
+		if (first == 0)
+			first = clst;
+		last = clst;
+		cnt++;
+	}
+	ticks = timer_elapsed (start);
+	bench_print_per_op (cnt, "clusters allocated", ticks, "cluster");
+	if (first != 0)
+		fat_remove_chain (first, 0);
+#else
+	printf ("fat-bench: no FAT in this file system.\n");
+#endif
+}
+
+/* Prints how fragmented each file in the root directory is: the number
+ * of runs of adjacent clusters its data is split into. */
+void
+fsutil_frag (char **argv UNUSED) {
+#ifdef EFILESYS
+	struct dir *dir;
+	char name[NAME_MAX + 1];
+	size_t file_cnt = 0, cluster_total = 0, run_total = 0;
+
+	printf ("Fragmentation of the root directory:\n");
+	dir = dir_open_root ();
+	if (dir == NULL)
+		PANIC ("root dir open failed");
+	while (dir_readdir (dir, name)) {
+		struct inode *inode;
+		size_t clusters = 0, runs = 0;
+
+		if (!dir_lookup (dir, name, &inode))
+			continue;
+		if (inode->data.type != INODE_LINK && !inode_is_inline (inode)) {
+			cluster_t prev = 0;
+			for (cluster_t clst = sector_to_cluster (inode->data.start);
+					clst != EOChain && clst != 0; clst = fat_get (clst)) {
+				if (clst != prev + 1)
+					runs++;
+				clusters++;
+				prev = clst;
+			}
+			printf ("%s: %zu clusters in %zu runs\n", name, clusters, runs);
+			file_cnt++;
+			cluster_total += clusters;
+			run_total += runs;
+		}
+		inode_close (inode);
+	}
+	dir_close (dir);
+	printf ("%zu files, %zu clusters in %zu runs.\n",
+			file_cnt, cluster_total, run_total);
+#else
+	printf ("frag: no FAT in this file system.\n");
+#endif
+}
+
+/* Benchmarks random access: creates an 8 MB file, makes 1000 reads of
+ * 512 bytes at random sectors in it, prints the time they took, and
+ * deletes the file. */
+void
+fsutil_read_bench (char **argv UNUSED) {
+	static const char *name = "read-bench";
+	const int read_cnt = 1000;
+	off_t size = bench_clamp_size (8 * 1024 * 1024);
+	struct file *file;
+	char *buffer;
+	int64_t start, ticks;
+
+	printf ("Creating a %"PROTd" byte file...\n", size);
+	if (size < DISK_SECTOR_SIZE || !filesys_create (name, size))
+		PANIC ("%s: create failed", name);
+	file = filesys_open (name, NULL);
+	if (file == NULL)
+		PANIC ("%s: open failed", name);
+	buffer = malloc (DISK_SECTOR_SIZE);
+	if (buffer == NULL)
+		PANIC ("couldn't allocate buffer");
+
+	start = timer_ticks ();
+	for (int i = 0; i < read_cnt; i++) {
+		off_t ofs = random_ulong () % (size / DISK_SECTOR_SIZE) * DISK_SECTOR_SIZE;
+		if (file_read_at (file, buffer, DISK_SECTOR_SIZE, ofs) != DISK_SECTOR_SIZE)
+			PANIC ("%s: read failed at %"PROTd, name, ofs);
+	}
+	ticks = timer_elapsed (start);
+	bench_print_per_op (read_cnt, "random reads", ticks, "read");
+
+	free (buffer);
+	file_close (file);
+	filesys_remove (name);
+}
+
+/* Benchmarks sequential throughput: writes an 8 MB file 4 kB at a time,
+ * closes it so that it reaches the disk, reads it back the same way,
+ * prints the time both took along with the cluster size and the memory
+ * the FAT takes, and deletes the file. */
+void
+fsutil_seq_bench (char **argv UNUSED) {
+	static const char *name = "seq-bench";
+	const off_t chunk = 4096;
+	off_t size = bench_clamp_size (8 * 1024 * 1024) / chunk * chunk;
+	struct file *file;
+	char *buffer;
+	int64_t start, ticks;
+	off_t ofs;
+
+#ifdef EFILESYS
+	printf ("Cluster size %zu bytes, FAT takes %zu bytes.\n",
+			fat_cluster_size (), fat_footprint ());
+#endif
+	if (size == 0 || !filesys_create (name, 0))
+		PANIC ("%s: create failed", name);
+	buffer = malloc (chunk);
+	if (buffer == NULL)
+		PANIC ("couldn't allocate buffer");
+	memset (buffer, 0x5a, chunk);
+
+	file = filesys_open (name, NULL);
+	if (file == NULL)
+		PANIC ("%s: open failed", name);
+	start = timer_ticks ();
+	for (ofs = 0; ofs < size; ofs += chunk)
+		if (file_write (file, buffer, chunk) != chunk)
+			PANIC ("%s: write failed at %"PROTd, name, ofs);
+	file_close (file);
+	ticks = timer_elapsed (start);
+	printf ("Wrote %"PROTd" bytes in %"PRId64" ticks.\n", size, ticks);
+
+	file = filesys_open (name, NULL);
+	if (file == NULL)
+		PANIC ("%s: open failed", name);
+	start = timer_ticks ();
+	for (ofs = 0; ofs < size; ofs += chunk)
+		if (file_read (file, buffer, chunk) != chunk)
+			PANIC ("%s: read failed at %"PROTd, name, ofs);
+	ticks = timer_elapsed (start);
+	printf ("Read %"PROTd" bytes in %"PRId64" ticks.\n", size, ticks);
+
+	free (buffer);
+	file_close (file);
+	filesys_remove (name);
+}
+
+/* Benchmarks the open inode table: creates 10,000 inodes and keeps them
+ * all open while it opens each one once more, prints the time that
+ * took, and deletes them. */
+void
+fsutil_open_bench (char **argv UNUSED) {
+#ifdef EFILESYS
+	size_t cnt = 10000, i;
+	struct inode **inodes;
+	int64_t start, ticks;
+
+	if (cnt > fat_free_cnt () / 2)
+		cnt = fat_free_cnt () / 2;
+	inodes = calloc (cnt, sizeof *inodes);
+	if (inodes == NULL)
+		PANIC ("couldn't allocate inode array");
+
+	printf ("Creating and opening %zu inodes...\n", cnt);
+	for (i = 0; i < cnt; i++) {
+		cluster_t clst = fat_create_chain (0);
+		if (clst == 0
+				|| !inode_create (cluster_to_sector (clst), 0, NULL, INODE_FILE))
+			PANIC ("open-bench: create failed");
+		inodes[i] = inode_open (cluster_to_sector (clst));
+		if (inodes[i] == NULL)
+			PANIC ("open-bench: open failed");
+	}
+
+	start = timer_ticks ();
+	for (i = 0; i < cnt; i++) {
+		disk_sector_t sector = inode_get_inumber (inodes[cnt - 1 - i]);
+		inode_close (inode_open (sector));
+	}
+	ticks = timer_elapsed (start);
+	bench_print_per_op (cnt, "opens", ticks, "open");
+
+	for (i = 0; i < cnt; i++) {
+		inode_remove (inodes[i]);
+		inode_close (inodes[i]);
+	}
+	free (inodes);
+#else
+	printf ("open-bench: no FAT in this file system.\n");
+#endif
+}
+
+/* Benchmarks name lookup in a large directory: adds 10,000 names to a
+ * new directory, looks each of them up, prints the time both took, and
+ * deletes the directory. */
+void
+fsutil_dir_bench (char **argv UNUSED) {
+#ifdef EFILESYS
+	const int name_cnt = 10000;
+	char name[NAME_MAX + 1];
+	cluster_t dir_clst, file_clst;
+	struct inode *inode;
+	struct dir *dir;
+	int64_t start, ticks;
+	int i;
+
+	/* All the names are for the same empty file. */
+	dir_clst = fat_create_chain (0);
+	file_clst = fat_create_chain (0);
+	if (dir_clst == 0 || file_clst == 0
+			|| !dir_create (cluster_to_sector (dir_clst), 0)
+			|| !inode_create (cluster_to_sector (file_clst), 0, NULL, INODE_FILE))
+		PANIC ("dir-bench: create failed");
+	dir = dir_open (inode_open (cluster_to_sector (dir_clst)));
+	if (dir == NULL)
+		PANIC ("dir-bench: open failed");
+
+	start = timer_ticks ();
+	for (i = 0; i < name_cnt; i++) {
+		snprintf (name, sizeof name, "f%d", i);
+		if (!dir_add (dir, name, cluster_to_sector (file_clst)))
+			PANIC ("dir-bench: adding %s failed", name);
+	}
+	ticks = timer_elapsed (start);
+	bench_print_per_op (name_cnt, "adds", ticks, "add");
+
+	start = timer_ticks ();
+	for (i = 0; i < name_cnt; i++) {
+		snprintf (name, sizeof name, "f%d", i);
+		if (!dir_lookup (dir, name, &inode))
+			PANIC ("dir-bench: %s not found", name);
+		inode_close (inode);
+	}
+	ticks = timer_elapsed (start);
+	bench_print_per_op (name_cnt, "lookups", ticks, "lookup");
+
+	inode_remove (dir_get_inode (dir));
+	dir_close (dir);
+	inode = inode_open (cluster_to_sector (file_clst));
+	inode_remove (inode);
+	inode_close (inode);
+#else
+	printf ("dir-bench: no FAT in this file system.\n");
+#endif
+}
+
+/* Benchmarks sparse files: creates a 64 MB file, writes a sector in the
+ * middle of it and one at the end, reads it all back, prints the time
+ * each step took and the disk statistics before and after, and deletes
+ * the file. */
+void
+fsutil_sparse_bench (char **argv UNUSED) {
+	static const char *name = "sparse-bench";
+	const off_t size = 64 * 1024 * 1024;
+	const off_t chunk = 4096;
+	struct file *file;
+	char *buffer;
+	int64_t start, ticks;
+	off_t ofs;
+
+	buffer = malloc (chunk);
+	if (buffer == NULL)
+		PANIC ("couldn't allocate buffer");
+	disk_print_stats ();
+
+	start = timer_ticks ();
+	if (!filesys_create (name, size))
+		PANIC ("%s: create failed", name);
+	ticks = timer_elapsed (start);
+	printf ("Created a %"PROTd" byte file in %"PRId64" ticks.\n", size, ticks);
+
+	file = filesys_open (name, NULL);
+	if (file == NULL)
+		PANIC ("%s: open failed", name);
+	memset (buffer, 0x5a, DISK_SECTOR_SIZE);
+	start = timer_ticks ();
+	if (file_write_at (file, buffer, DISK_SECTOR_SIZE, size / 2) != DISK_SECTOR_SIZE
+			|| file_write_at (file, buffer, DISK_SECTOR_SIZE, size) != DISK_SECTOR_SIZE)
+		PANIC ("%s: write failed", name);
+	ticks = timer_elapsed (start);
+	printf ("Wrote 2 sectors in %"PRId64" ticks.\n", ticks);
+
+	start = timer_ticks ();
+	for (ofs = 0; ofs < size; ofs += chunk) {
+		if (file_read_at (file, buffer, chunk, ofs) != chunk)
+			PANIC ("%s: read failed at %"PROTd, name, ofs);
+		if (ofs != size / 2 && buffer[0] != 0)
+			PANIC ("%s: hole not zero at %"PROTd, name, ofs);
+	}
+	ticks = timer_elapsed (start);
+	printf ("Read %"PROTd" bytes in %"PRId64" ticks.\n", size, ticks);
+
+	file_close (file);
+	filesys_remove (name);
+	free (buffer);
+	disk_print_stats ();
+}
+
+/* Threads in multi-bench, and bytes each one writes and reads. */
+#define MULTI_THREADS 4
+#define MULTI_SIZE (1024 * 1024)
+
+/* One thread of multi-bench. */
+struct multi_job {
+	char name[16];                      /* File to work on. */
+	bool write;                         /* Write it, or else read it. */
+	struct semaphore *done;             /* Upped when finished. */
+};
+
+static void
+multi_bench_thread (void *job_) {
+	struct multi_job *job = job_;
+	const off_t chunk = 4096;
+	struct file *file = filesys_open (job->name, NULL);
+	char *buffer = malloc (chunk);
+	off_t ofs;
+
+	if (file == NULL || buffer == NULL)
+		PANIC ("multi-bench: open of %s failed", job->name);
+	memset (buffer, 0x5a, chunk);
+	for (ofs = 0; ofs < MULTI_SIZE; ofs += chunk) {
+		off_t n = job->write ? file_write (file, buffer, chunk)
+			: file_read (file, buffer, chunk);
+		if (n != chunk)
+			PANIC ("multi-bench: %s failed at %"PROTd,
+					job->write ? "write" : "read", ofs);
+	}
+	free (buffer);
+	file_close (file);
+	sema_up (job->done);
+}
+
+/* Runs the MULTI_THREADS jobs in JOBS at once and returns the ticks
+ * until all of them are done. */
+static int64_t
+multi_bench_run (struct multi_job *jobs) {
+	struct semaphore done;
+	int64_t start;
+	int i;
+
+	sema_init (&done, 0);
+	start = timer_ticks ();
+	for (i = 0; i < MULTI_THREADS; i++) {
+		jobs[i].done = &done;
+		if (thread_create (jobs[i].name, PRI_DEFAULT, multi_bench_thread,
+					&jobs[i]) == TID_ERROR)
+			PANIC ("multi-bench: thread_create failed");
+	}
+	for (i = 0; i < MULTI_THREADS; i++)
+		sema_down (&done);
+	return timer_elapsed (start);
+}
+
+/* Times threads writing and reading files at the same time: each its
+ * own file, then all the same one. */
+void
+fsutil_multi_bench (char **argv UNUSED) {
+	struct multi_job jobs[MULTI_THREADS];
+	int64_t ticks;
+	int i;
+
+	for (i = 0; i < MULTI_THREADS; i++) {
+		snprintf (jobs[i].name, sizeof jobs[i].name, "multi-%d", i);
+		if (!filesys_create (jobs[i].name, 0))
+			PANIC ("multi-bench: create of %s failed", jobs[i].name);
+		jobs[i].write = true;
+	}
+	ticks = multi_bench_run (jobs);
+	printf ("%d threads wrote a file each, %d bytes, in %"PRId64" ticks.\n",
+			MULTI_THREADS, MULTI_SIZE, ticks);
+
+	for (i = 0; i < MULTI_THREADS; i++)
+		jobs[i].write = false;
+	ticks = multi_bench_run (jobs);
+	printf ("%d threads read a file each, %d bytes, in %"PRId64" ticks.\n",
+			MULTI_THREADS, MULTI_SIZE, ticks);
+
+	for (i = 0; i < MULTI_THREADS; i++)
+		strlcpy (jobs[i].name, "multi-0", sizeof jobs[i].name);
+	ticks = multi_bench_run (jobs);
+	printf ("%d threads read one file, %d bytes, in %"PRId64" ticks.\n",
+			MULTI_THREADS, MULTI_SIZE, ticks);
+
+	for (i = 0; i < MULTI_THREADS; i++) {
+		char name[16];
+		snprintf (name, sizeof name, "multi-%d", i);
+		filesys_remove (name);
+	}
+}
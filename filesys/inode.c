@@ -6,6 +6,9 @@
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
 #include "filesys/fat.h"
+#ifdef EFILESYS
+#include "vm/vm.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -17,6 +20,38 @@ bytes_to_sectors (off_t size) {
 	return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
+#ifdef EFILESYS
+/* Returns the number of clusters to allocate for an inode SIZE
+ * bytes long. */
+static inline size_t
+bytes_to_clusters (off_t size) {
+	return DIV_ROUND_UP (size, fat_cluster_size ());
+}
+
+/* Fills cluster CLST with zeros, in one disk request. */
+static void
+zero_cluster (cluster_t clst) {
+	static char zeros[DISK_SECTOR_SIZE];
+	const void *buffers[SECTORS_PER_CLUSTER_MAX];
+	size_t i;
+
+	for (i = 0; i < fat_sectors_per_cluster (); i++)
+		buffers[i] = zeros;
+	disk_write_multiple (filesys_disk, cluster_to_sector (clst), i, buffers);
+}
+
+/* Makes CLST, just allocated as cluster number IDX of INODE's data,
+ * read as zeros. The zeros go to the page cache and reach the disk with
+ * the data written over them; only when memory is short are they
+ * written at once. */
+static void
+inode_zero_cluster (struct inode *inode, size_t idx, cluster_t clst) {
+	if (!page_cache_zero (inode, idx * fat_cluster_size (),
+				cluster_to_sector (clst), fat_sectors_per_cluster ()))
+		zero_cluster (clst);
+}
+#endif
+
 /* Returns the disk sector that contains byte offset POS within
  * INODE.
  * Returns -1 if INODE does not contain data for a byte at offset
@@ -30,14 +65,31 @@ byte_to_sector (const struct inode *inode, off_t pos) {
 		return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Table of open inodes, keyed by sector, so that opening a single inode
+ * twice returns the same `struct inode'. An inode stays in it as long as
+ * its open_cnt is nonzero. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+static struct condition inode_closed;   /* A closing inode left the table. */
+
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct inode, elem)->sector
+		< hash_entry (b, struct inode, elem)->sector;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	hash_init (&open_inodes, inode_hash, inode_less, NULL);
+	lock_init (&open_inodes_lock);
+	cond_init (&inode_closed);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -65,32 +117,30 @@ inode_create (disk_sector_t sector, off_t length, const char* target, enum inode
 			disk_write(filesys_disk, sector, disk_inode);
 			success = true;
 		} else {
-			size_t sectors = bytes_to_sectors (length);
-			sectors = sectors==0 ? 1 : sectors;
+			size_t clusters = bytes_to_clusters (length);
+			clusters = clusters==0 ? 1 : clusters;
 			disk_inode->length = length;
 			disk_inode->magic = INODE_MAGIC;
-			if (fat_enough_space(sectors)){
-				if (sectors > 0) {			
-					static char zeros[DISK_SECTOR_SIZE];
-					size_t i;
-					cluster_t tmp = fat_create_chain(0);
-					if (tmp==0) {
-						return false;
-					}
+			/* Small enough to keep in the inode sector. */
+			if ((size_t) length <= INODE_INLINE_MAX) {
+				disk_write (filesys_disk, sector, disk_inode);
+				success = true;
+			}
+			/* Only the first cluster is allocated, and it is zeroed
+			 * on its first write. The rest is a hole until it is
+			 * written. */
+			else if (fat_enough_space(1)){
+				cluster_t tmp = fat_create_chain(0);
+				if (tmp!=0) {
 					disk_inode->start = cluster_to_sector(tmp);
-					
-					disk_write (filesys_disk, sector, disk_inode);
-
-					disk_write (filesys_disk, cluster_to_sector(tmp), zeros);
-					for (i = 1; i < sectors; i++){
-						tmp = fat_create_chain(tmp);
-						if (tmp==0) {
-							return false;
-						}
-						disk_write (filesys_disk, cluster_to_sector(tmp), zeros); 
+					disk_inode->unwritten = 1;
+					if (clusters > 1) {
+						disk_inode->hole_cnt = 1;
+						disk_inode->holes[0] = (struct inode_hole) { 1, clusters - 1 };
 					}
+					disk_write (filesys_disk, sector, disk_inode);
+					success = true;
 				}
-				success = true; 
 			} 
 		}
 		
@@ -127,39 +177,60 @@ inode_create (disk_sector_t sector, off_t length, const char* target, enum inode
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
+	struct hash_elem *e;
 	struct inode *inode;
+	struct inode key;
 
 	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
-		}
+	key.sector = sector;
+	lock_acquire (&open_inodes_lock);
+	/* An inode being closed is not on disk yet: wait until it is. */
+	while ((e = hash_find (&open_inodes, &key.elem)) != NULL
+			&& hash_entry (e, struct inode, elem)->closing)
+		cond_wait (&inode_closed, &open_inodes_lock);
+	if (e != NULL) {
+		inode = hash_entry (e, struct inode, elem);
+		inode->open_cnt++;
+		lock_release (&open_inodes_lock);
+		return inode;
 	}
 
 	/* Allocate memory. */
 	inode = malloc (sizeof *inode);
-	if (inode == NULL)
+	if (inode == NULL) {
+		lock_release (&open_inodes_lock);
 		return NULL;
+	}
 
 	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
 	inode->sector = sector;
+	hash_insert (&open_inodes, &inode->elem);
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
+	inode->closing = false;
+	list_init (&inode->cache_pages);
+	inode->prealloc_cnt = 0;
+	inode->extents = NULL;
+	inode->extent_cnt = inode->extent_cap = 0;
+	lock_init (&inode->chain_lock);
+	rwlock_init (&inode->rw);
+	lock_init (&inode->dir_lock);
+	inode->dirty = false;
+	inode->index = NULL;
 	disk_read (filesys_disk, inode->sector, &inode->data);
+	lock_release (&open_inodes_lock);
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		lock_acquire (&open_inodes_lock);
 		inode->open_cnt++;
+		lock_release (&open_inodes_lock);
+	}
 	return inode;
 }
 
@@ -179,27 +250,60 @@ inode_close (struct inode *inode) {
 		return;
 
 	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+	lock_acquire (&open_inodes_lock);
+	if (--inode->open_cnt > 0) {
+		lock_release (&open_inodes_lock);
+		return;
+	}
+	/* Stay in the inode table, so that a new opener waits, until the
+	 * data and the inode are on disk for it to read. */
+	inode->closing = true;
+	lock_release (&open_inodes_lock);
+
+#ifdef EFILESYS
+	page_cache_close (inode);
+	fat_unreserve (inode->prealloc, inode->prealloc_cnt);
+#endif
+	if (inode->dirty && !inode->removed)
 		disk_write(filesys_disk, inode->sector, &inode->data);
 
-		/* Deallocate blocks if removed. */
-		if (inode->removed) {
+	lock_acquire (&open_inodes_lock);
+	hash_delete (&open_inodes, &inode->elem);
+	cond_broadcast (&inode_closed, &open_inodes_lock);
+	lock_release (&open_inodes_lock);
+
+#ifdef EFILESYS
+
+	/* A directory's hash index and cached names go with it. */
+	if (inode->removed && inode->data.type == INODE_DIR)
+		dir_forget (inode->sector);
+	if (inode->removed && inode->data.type == INODE_DIR
+			&& !inode_is_inline (inode)
+			&& inode->data.index != 0 && inode->index == NULL)
+		inode->index = inode_open (inode->data.index);
+	if (inode->index != NULL) {
+		if (inode->removed)
+			inode_remove (inode->index);
+		inode_close (inode->index);
+	}
+#endif
+
+	/* Deallocate blocks if removed. */
+	if (inode->removed) {
 #ifdef EFILESYS	
-			fat_remove_chain(sector_to_cluster(inode->sector), 0);
-			if (inode->data.type!=INODE_LINK) {
-				fat_remove_chain(sector_to_cluster(inode->data.start), 0);
-			}
+		fat_remove_chain(sector_to_cluster(inode->sector), 0);
+		if (inode->data.type!=INODE_LINK && !inode_is_inline (inode)) {
+			fat_remove_chain(sector_to_cluster(inode->data.start), 0);
+		}
 #else
-			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
+		free_map_release (inode->sector, 1);
+		free_map_release (inode->data.start,
+				bytes_to_sectors (inode->data.length)); 
 #endif
-		}
-
-		free (inode); 
 	}
+
+	free (inode->extents);
+	free (inode); 
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -210,11 +314,135 @@ inode_remove (struct inode *inode) {
 	inode->removed = true;
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
- * Returns the number of bytes actually read, which may be less
- * than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
+#ifdef EFILESYS
+/* Returns cluster number IDX of INODE's data, or EOChain if its chain is
+ * not that long. The chain is cached in INODE as a list of extents, and
+ * the FAT is only followed past the part cached so far. Growing the
+ * chain does not make the cache stale, since it only ever covers a
+ * prefix of the chain that ended at EOChain when read. */
+static cluster_t
+inode_cluster (struct inode *inode, size_t idx) {
+	struct inode_extent *ext;
+	size_t lo, hi;
+	cluster_t clst = EOChain;
+
+	lock_acquire (&inode->chain_lock);
+	if (inode->extent_cnt == 0) {
+		inode->extents = malloc (4 * sizeof *inode->extents);
+		if (inode->extents == NULL)
+			goto done;
+		inode->extent_cap = 4;
+		inode->extents[0] = (struct inode_extent) {
+			0, sector_to_cluster (inode->data.start), 1 };
+		inode->extent_cnt = 1;
+	}
+
+	/* Read the chain on up to IDX. */
+	for (;;) {
+		ext = &inode->extents[inode->extent_cnt - 1];
+		if (idx < ext->idx + ext->cnt)
+			break;
+		cluster_t next = fat_get (ext->clst + ext->cnt - 1);
+		if (next == EOChain || next == 0)
+			goto done;
+		if (next == ext->clst + ext->cnt) {
+			ext->cnt++;
+			continue;
+		}
+		if (inode->extent_cnt == inode->extent_cap) {
+			struct inode_extent *extents = realloc (inode->extents,
+					2 * inode->extent_cap * sizeof *extents);
+			if (extents == NULL)
+				goto done;
+			inode->extents = extents;
+			inode->extent_cap *= 2;
+			ext = &inode->extents[inode->extent_cnt - 1];
+		}
+		inode->extents[inode->extent_cnt++] = (struct inode_extent) {
+			ext->idx + ext->cnt, next, 1 };
+	}
+
+	/* Binary search for the extent that holds IDX. */
+	lo = 0;
+	hi = inode->extent_cnt;
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (inode->extents[mid].idx <= idx)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	ext = &inode->extents[lo];
+	clst = ext->clst + (idx - ext->idx);
+done:
+	lock_release (&inode->chain_lock);
+	return clst;
+}
+
+/* Returns the last cluster of INODE's chain and stores the length of the
+ * chain in *LEN. */
+static cluster_t
+inode_chain_end (struct inode *inode, size_t *len) {
+	cluster_t clst = sector_to_cluster (inode->data.start);
+	size_t cnt = 1;
+
+	lock_acquire (&inode->chain_lock);
+	if (inode->extent_cnt > 0) {
+		struct inode_extent *ext = &inode->extents[inode->extent_cnt - 1];
+		clst = ext->clst + ext->cnt - 1;
+		cnt = ext->idx + ext->cnt;
+	}
+	lock_release (&inode->chain_lock);
+	/* Past the cached part, if the cache could not grow. */
+	for (cluster_t next; (next = fat_get (clst)) != EOChain && next != 0; cnt++)
+		clst = next;
+	*len = cnt;
+	return clst;
+}
+
+/* Forgets the part of INODE's cached chain from position POS on, which
+ * has changed. */
+static void
+inode_chain_cut (struct inode *inode, size_t pos) {
+	lock_acquire (&inode->chain_lock);
+	while (inode->extent_cnt > 0) {
+		struct inode_extent *ext = &inode->extents[inode->extent_cnt - 1];
+		if (ext->idx < pos) {
+			if (ext->idx + ext->cnt > pos)
+				ext->cnt = pos - ext->idx;
+			break;
+		}
+		inode->extent_cnt--;
+	}
+	lock_release (&inode->chain_lock);
+}
+
+/* Returns cluster number IDX of INODE's data, 0 if it is in a hole, or
+ * EOChain if it is past the end. The chain holds the clusters of the
+ * data that are not in holes, in order. */
+static cluster_t
+inode_data_cluster (struct inode *inode, size_t idx) {
+	const struct inode_disk *data = &inode->data;
+	size_t pos = idx;
+
+	if (idx == 0 && data->unwritten)
+		return 0;
+	for (size_t h = 0; h < data->hole_cnt; h++) {
+		if (idx < data->holes[h].idx)
+			break;
+		if (idx < data->holes[h].idx + data->holes[h].cnt)
+			return 0;
+		pos -= data->holes[h].cnt;
+	}
+	return inode_cluster (inode, pos);
+}
+#endif
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET,
+ * with INODE's lock held. */
+static off_t
+inode_read_locked (struct inode *inode, void *buffer_, off_t size,
+		off_t offset) {
 	if (offset >= inode->data.length) {
 		return 0; // A read starting from a position past EOF returns no bytes.
 	}
@@ -223,9 +451,17 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *bounce = NULL;
 
 #ifdef EFILESYS
-	cluster_t tmp = sector_to_cluster(inode->data.start);
-	for (int i=0; i < offset/DISK_SECTOR_SIZE; i++){
-		tmp = fat_get(tmp);
+	if (inode_is_inline (inode)) {
+		if (size > inode->data.length - offset)
+			size = inode->data.length - offset;
+		memcpy (buffer, inode->data.inline_data + offset, size);
+		return size;
+	}
+
+	size_t csize = fat_cluster_size ();
+	cluster_t tmp = inode_data_cluster(inode, offset/csize);
+	if (tmp==EOChain) {
+		return 0;
 	}
 #endif
 
@@ -233,8 +469,8 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		/* Disk sector to read, starting byte offset within sector. */
 
 #ifdef EFILESYS
-		disk_sector_t sector_idx = cluster_to_sector(tmp);
-		// tmp = fat_get(tmp);
+		disk_sector_t sector_idx = cluster_to_sector(tmp)
+			+ offset % csize / DISK_SECTOR_SIZE;
 #else
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
 #endif
@@ -251,6 +487,13 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
+#ifdef EFILESYS
+		if (tmp == 0)
+			memset (buffer + bytes_read, 0, chunk_size);
+		else if (!page_cache_read (inode, offset, sector_idx,
+					buffer + bytes_read, chunk_size))
+			break;
+#else
 		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
 			/* Read full sector directly into caller's buffer. */
 			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
@@ -265,28 +508,279 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 			disk_read (filesys_disk, sector_idx, bounce);
 			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
 		}
+#endif
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 
-		tmp = fat_get(tmp);
-		if (size > 0 && tmp == EOChain){
-			break;
+#ifdef EFILESYS
+		if (offset % csize == 0) {
+			tmp = inode_data_cluster(inode, offset/csize);
+			if (size > 0 && tmp == EOChain){
+				break;
+			}
 		}
+#endif
 	}
 	free (bounce);
 	return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
- * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+ * Returns the number of bytes actually read, which may be less
+ * than SIZE if an error occurs or end of file is reached. Reads of the
+ * same inode run side by side; a write waits for them. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) {
+	off_t bytes_read;
+
+	rwlock_acquire_read (&inode->rw);
+	bytes_read = inode_read_locked (inode, buffer, size, offset);
+	rwlock_release_read (&inode->rw);
+	return bytes_read;
+}
+
+/* Read-ahead window, in bytes. It starts at RA_MIN after a random
+ * read and doubles, up to RA_MAX, each time more is read ahead. */
+#define RA_MIN (8 * DISK_SECTOR_SIZE)
+#define RA_MAX (128 * DISK_SECTOR_SIZE)
+
+/* Tells the read-ahead of an open file, whose state is RA, that SIZE
+ * bytes at OFFSET in INODE are about to be read. While the file is read
+ * sequentially, the data past the read is read into the page cache in
+ * the background, a window ahead of the reader. A read anywhere else
+ * collapses the window. */
+void
+inode_readahead (struct inode *inode UNUSED, struct readahead *ra UNUSED,
+		off_t size UNUSED, off_t offset UNUSED) {
+#ifdef EFILESYS
+	off_t end = offset + size;
+
+	if (offset != ra->next) {
+		ra->next = end;
+		ra->win = 0;
+		return;
+	}
+	ra->next = end;
+	if (ra->win == 0) {
+		ra->win = RA_MIN;
+		ra->end = end;
+	}
+	if (ra->end < end)
+		ra->end = end;
+	/* Read more once the reader is halfway into what was read ahead,
+	 * so that it does not catch up. */
+	if (ra->end - end < ra->win / 2 && ra->end < inode_length (inode)) {
+		off_t start = ra->end;
+		ra->win = ra->win * 2 < RA_MAX ? ra->win * 2 : RA_MAX;
+		ra->end = end + ra->win;
+		page_cache_readahead_async (inode, start, ra->end);
+	}
+#endif
+}
+
+#ifdef EFILESYS
+/* Reads the data of INODE between START and END, as far as INODE goes,
+ * into the page cache. */
+void
+inode_prefetch (struct inode *inode, off_t start, off_t end) {
+	disk_sector_t sectors[PAGE_CACHE_SECTORS];
+	off_t ofs = start / DISK_SECTOR_SIZE * DISK_SECTOR_SIZE;
+	size_t csize = fat_cluster_size ();
+	cluster_t clst = EOChain;
+	size_t clst_idx = SIZE_MAX;
+
+	rwlock_acquire_read (&inode->rw);
+	if (end > inode_length (inode))
+		end = inode_length (inode);
+	if (inode_is_inline (inode))
+		end = 0;
+
+	/* One page at a time, so that runs of adjacent sectors are read
+	 * together. Holes have nothing to read. */
+	while (ofs < end) {
+		off_t page_ofs = ofs;
+		size_t cnt = 0;
+		while (ofs < end && (cnt == 0 || ofs % PGSIZE != 0)) {
+			if (ofs / csize != clst_idx) {
+				clst_idx = ofs / csize;
+				clst = inode_data_cluster (inode, clst_idx);
+			}
+			if (clst == 0 || clst == EOChain)
+				break;
+			sectors[cnt++] = cluster_to_sector (clst)
+				+ ofs % csize / DISK_SECTOR_SIZE;
+			ofs += DISK_SECTOR_SIZE;
+		}
+		if (cnt > 0 && !page_cache_prefetch (inode, page_ofs, sectors, cnt))
+			break;
+		if (clst == EOChain)
+			break;
+		if (clst == 0)
+			ofs = (clst_idx + 1) * csize;
+	}
+	rwlock_release_read (&inode->rw);
+}
+#endif
+
+#ifdef EFILESYS
+/* Clusters to preallocate for a growing file. */
+#define PREALLOC_CLUSTERS 8
+
+/* Appends a cluster to INODE's chain, which ends at LAST, and returns it,
+ * or 0 if the disk is full. The clusters following LAST are preallocated
+ * to INODE while they are free, so that the file stays contiguous even
+ * while other files grow at the same time. */
+static cluster_t
+inode_grow (struct inode *inode, cluster_t last) {
+	cluster_t clst;
+
+	if (inode->prealloc_cnt == 0 || inode->prealloc != last + 1) {
+		fat_unreserve (inode->prealloc, inode->prealloc_cnt);
+		inode->prealloc = last + 1;
+		inode->prealloc_cnt = fat_reserve (last, PREALLOC_CLUSTERS);
+	}
+	if (inode->prealloc_cnt == 0)
+		return fat_create_chain (last);
+	clst = inode->prealloc++;
+	inode->prealloc_cnt--;
+	fat_link (last, clst);
+	return clst;
+}
+
+/* Adds a hole of CNT clusters from cluster IDX on at the end of INODE's
+ * data. Returns false if INODE has no room for another hole. */
+static bool
+inode_hole_add (struct inode *inode, size_t idx, size_t cnt) {
+	struct inode_disk *data = &inode->data;
+
+	if (data->hole_cnt > 0) {
+		struct inode_hole *last = &data->holes[data->hole_cnt - 1];
+		if (last->idx + last->cnt == idx) {
+			last->cnt += cnt;
+			inode->dirty = true;
+			return true;
+		}
+	}
+	if (data->hole_cnt == INODE_HOLE_MAX)
+		return false;
+	data->holes[data->hole_cnt++] = (struct inode_hole) { idx, cnt };
+	inode->dirty = true;
+	return true;
+}
+
+/* Allocates the first cluster of hole number H of INODE, which comes
+ * after chain position POS - 1, and returns it, or 0 if the disk is
+ * full. */
+static cluster_t
+inode_hole_fill (struct inode *inode, size_t h, size_t pos) {
+	struct inode_disk *data = &inode->data;
+	struct inode_hole *hole = &data->holes[h];
+	cluster_t clst = fat_insert (inode_cluster (inode, pos - 1));
+
+	if (clst == 0)
+		return 0;
+	inode_zero_cluster (inode, hole->idx, clst);
+	inode_chain_cut (inode, pos);
+	inode->dirty = true;
+	hole->idx++;
+	if (--hole->cnt == 0) {
+		memmove (hole, hole + 1, (--data->hole_cnt - h) * sizeof *hole);
+	}
+	return clst;
+}
+
+/* Returns cluster number IDX of INODE's data, allocating it if it is in
+ * a hole or past the end, or 0 if the disk is full. The clusters between
+ * the end and IDX become a hole. */
+static cluster_t
+inode_alloc_cluster (struct inode *inode, size_t idx) {
+	struct inode_disk *data = &inode->data;
+	size_t pos = idx, h, len;
+	cluster_t clst, last;
+
+	if (data->unwritten) {
+		/* First write since inode_create(). */
+		inode_zero_cluster (inode, 0, sector_to_cluster (data->start));
+		data->unwritten = 0;
+		inode->dirty = true;
+	}
+	for (h = 0; h < data->hole_cnt; h++) {
+		struct inode_hole *hole = &data->holes[h];
+		if (idx < hole->idx)
+			break;
+		if (idx < hole->idx + hole->cnt) {
+			/* In a hole. Without room to split it, fill it from the
+			 * front up to IDX. */
+			size_t before = idx - hole->idx;
+			pos -= before;
+			if (before > 0 && data->hole_cnt == INODE_HOLE_MAX)
+				for (; before > 0; before--, pos++)
+					if (inode_hole_fill (inode, h, pos) == 0)
+						return 0;
+			if (before == 0)
+				return inode_hole_fill (inode, h, pos);
+			/* Split the hole around IDX. */
+			memmove (hole + 1, hole, (data->hole_cnt++ - h) * sizeof *hole);
+			hole->cnt = before;
+			hole[1].idx = idx;
+			hole[1].cnt -= before;
+			return inode_hole_fill (inode, h + 1, pos);
+		}
+		pos -= hole->cnt;
+	}
+
+	clst = inode_cluster (inode, pos);
+	if (clst != EOChain)
+		return clst;
+
+	/* Past the end. */
+	last = inode_chain_end (inode, &len);
+	if (pos > len && !inode_hole_add (inode, idx - (pos - len), pos - len)) {
+		/* No room for another hole: fill the gap with zeros. */
+		for (; len < pos; len++) {
+			last = inode_grow (inode, last);
+			if (last == 0)
+				return 0;
+			inode_zero_cluster (inode, idx - (pos - len), last);
+		}
+	}
+	clst = inode_grow (inode, last);
+	if (clst != 0)
+		inode_zero_cluster (inode, idx, clst);
+	return clst;
+}
+
+/* Moves the data of INODE out of the inode sector into a cluster of its
+ * own, once it outgrows the inode. Returns false if the disk is full. */
+static bool
+inode_uninline (struct inode *inode) {
+	struct inode_disk *data = &inode->data;
+	cluster_t clst = fat_create_chain (0);
+
+	if (clst == 0)
+		return false;
+	data->start = cluster_to_sector (clst);
+	inode_zero_cluster (inode, 0, clst);
+	if (data->length > 0
+			&& !page_cache_write (inode, 0, data->start, data->inline_data,
+				data->length)) {
+		data->start = 0;
+		fat_remove_chain (clst, 0);
+		return false;
+	}
+	memset (data->inline_data, 0, sizeof data->inline_data);
+	inode->dirty = true;
+	return true;
+}
+#endif
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET, with
+ * INODE's lock held for writing. */
+static off_t
+inode_write_locked (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
@@ -294,37 +788,40 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
 	if (inode->deny_write_cnt)
 		return 0;
+	inode->write_cnt++;
 
 #ifdef EFILESYS
-	cluster_t tmp = sector_to_cluster(inode->data.start);
-	for (int i=0; i < offset/DISK_SECTOR_SIZE; i++){
-		cluster_t old = tmp;
-		tmp = fat_get(old);
-		if (tmp==EOChain) {
-			tmp = fat_create_chain(old);
-			if (tmp==0) {
-				return 0;
-			}
-			static char zeros[DISK_SECTOR_SIZE];
-			disk_write(filesys_disk, cluster_to_sector(tmp), zeros);
+	if (inode_is_inline (inode)) {
+		if ((size_t) (offset + size) <= INODE_INLINE_MAX) {
+			memcpy (inode->data.inline_data + offset, buffer, size);
+			if (inode->data.length < offset + size)
+				inode->data.length = offset + size;
+			inode->dirty = true;
+			return size;
 		}
+		if (!inode_uninline (inode))
+			return 0;
+	}
+
+	size_t csize = fat_cluster_size ();
+	cluster_t tmp = inode_alloc_cluster(inode, offset/csize);
+	if (tmp==0) {
+		return 0;
 	}
 #endif
 
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
 #ifdef EFILESYS
-		disk_sector_t sector_idx = cluster_to_sector(tmp);
-		cluster_t old = tmp;
-		tmp = fat_get(old);
-		if (tmp==EOChain) {
-			tmp = fat_create_chain(old);
+		/* Move on to the next cluster, allocating it if need be. */
+		if (bytes_written > 0 && offset % csize == 0) {
+			tmp = inode_alloc_cluster(inode, offset/csize);
 			if (tmp==0) {
-				return 0;
+				break;
 			}
-			static char zeros[DISK_SECTOR_SIZE];
-			disk_write(filesys_disk, cluster_to_sector(tmp), zeros);
 		}
+		disk_sector_t sector_idx = cluster_to_sector(tmp)
+			+ offset % csize / DISK_SECTOR_SIZE;
 #else
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
 #endif
@@ -342,6 +839,11 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 			break;
 		}
 			
+#ifdef EFILESYS
+		if (!page_cache_write (inode, offset, sector_idx,
+					buffer + bytes_written, chunk_size))
+			break;
+#else
 		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
 			/* Write full sector directly to disk. */
 			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
@@ -363,17 +865,77 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
 			disk_write (filesys_disk, sector_idx, bounce); 
 		}
+#endif
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	inode->data.length = inode->data.length > offset+size ? inode->data.length : offset+size;
+	if (inode->data.length < offset + size) {
+		inode->data.length = offset + size;
+		inode->dirty = true;
+	}
 	free (bounce);
 	return bytes_written;
 }
 
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * Returns the number of bytes actually written, which may be
+ * less than SIZE if the disk is full or an error occurs. A write
+ * past the end extends INODE. Writes of the same inode run one at a
+ * time, apart from reads; writes of different inodes run side by
+ * side. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+		off_t offset) {
+	off_t bytes_written;
+
+	rwlock_acquire_write (&inode->rw);
+	bytes_written = inode_write_locked (inode, buffer, size, offset);
+	rwlock_release_write (&inode->rw);
+	return bytes_written;
+}
+
+/* Writes what is dirty of INODE's data, of the FAT entries of its
+ * data and, if it changed, of the on-disk inode back to disk. With
+ * META, also the FAT entry of the inode sector itself and a
+ * directory's hash index, which reading the data back does not need. */
+static void
+inode_flush (struct inode *inode, bool meta) {
+	rwlock_acquire_read (&inode->rw);
+#ifdef EFILESYS
+	page_cache_sync (inode);
+	if (inode->data.type != INODE_LINK && !inode_is_inline (inode))
+		fat_flush_chain (sector_to_cluster (inode->data.start));
+	if (meta)
+		fat_flush_chain (sector_to_cluster (inode->sector));
+#endif
+	if (inode->dirty) {
+		/* Cleared first: a change made while writing marks it again. */
+		inode->dirty = false;
+		disk_write (filesys_disk, inode->sector, &inode->data);
+	}
+	rwlock_release_read (&inode->rw);
+	if (meta && inode->index != NULL)
+		inode_flush (inode->index, true);
+}
+
+/* Writes INODE back to disk: its data, the on-disk inode and the FAT
+ * entries of both. Nothing belonging to other files is written. */
+void
+inode_sync (struct inode *inode) {
+	inode_flush (inode, true);
+}
+
+/* Writes as much of INODE back to disk as it takes to read its data
+ * back: the data, the FAT entries of the data and the on-disk inode
+ * if it changed. */
+void
+inode_datasync (struct inode *inode) {
+	inode_flush (inode, false);
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 	void
@@ -398,3 +960,14 @@ off_t
 inode_length (const struct inode *inode) {
 	return inode->data.length;
 }
+
+/* Returns true if INODE keeps its data in the inode sector, rather than
+ * in clusters of its own. */
+bool
+inode_is_inline (const struct inode *inode) {
+#ifdef EFILESYS
+	return inode->data.type != INODE_LINK && inode->data.start == 0;
+#else
+	return false;
+#endif
+}
@@ -1,6 +1,15 @@
 /* page_cache.c: Implementation of Page Cache (Buffer Cache). */
 
 #include "vm/vm.h"
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/fat.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+
+#ifdef EFILESYS
 static bool page_cache_readahead (struct page *page, void *kva);
 static bool page_cache_writeback (struct page *page);
 static void page_cache_destroy (struct page *page);
@@ -15,36 +24,560 @@ static const struct page_operations page_cache_op = {
 
 tid_t page_cache_workerd;
 
+/* Pages of file data, by inode and page number. The pages are in no
+ * process's address space; their frames come from the frame table, so
+ * that they are evicted, and written back, like user pages. */
+static struct hash cache;
+static struct lock cache_lock;         /* Guards cache and the inodes'
+                                          cache_pages lists. */
+
+static long long hit_cnt;              /* # of sectors found in cache. */
+static long long miss_cnt;             /* # of sectors read from disk. */
+static long long writeback_cnt;        /* # of sectors written back. */
+
+/* Read-ahead requests, carried out by page_cache_kworkerd so that the
+ * reader goes on with the data it has. */
+#define RA_QUEUE_MAX 16                /* Requests beyond are dropped. */
+struct ra_request {
+	struct inode *inode;
+	off_t start, end;                  /* Bytes to read. */
+	struct list_elem elem;             /* Element in ra_queue. */
+};
+static struct list ra_queue;
+static size_t ra_queue_len;
+static struct inode *ra_busy;          /* Inode being read ahead. */
+static struct lock ra_lock;            /* Guards the three above. */
+static struct condition ra_done;       /* Signaled when ra_busy is done. */
+static struct semaphore ra_sema;       /* Up once for each request. */
+
+static long long ra_cnt;               /* # of sectors read ahead. */
+static long long ra_hit_cnt;           /* # of them used later. */
+static long long ra_waste_cnt;         /* # dropped without being used. */
+
+/* Write-behind. Written data stays in the cache, and the flusher writes
+ * it back in the background: every FLUSH_INTERVAL, it writes the pages
+ * that have been dirty for FLUSH_AGE, or all dirty pages once they make
+ * up more than FLUSH_DIRTY_RATIO percent of the cache, and then the FAT.
+ * Eviction, closing the last opener, fsync and filesys_done() write back
+ * as well. */
+#define FLUSH_INTERVAL TIMER_FREQ      /* Ticks between runs. */
+#define FLUSH_AGE (5 * TIMER_FREQ)     /* Ticks data may stay dirty. */
+#define FLUSH_DIRTY_RATIO 25           /* Dirty pages, in percent. */
+static long long flush_cnt;            /* # of pages written by flusher. */
+static bool flush_busy;                /* Flusher has pages pinned. */
+static struct condition flush_done;    /* Signaled when it unpins them.
+                                          Both guarded by cache_lock. */
+
+static void page_cache_kworkerd (void *aux);
+static void page_cache_flushd (void *aux);
+
+/* Returns the number of bits set in BITS. */
+static int
+bit_cnt (uint8_t bits) {
+	int cnt = 0;
+	for (; bits != 0; bits &= bits - 1)
+		cnt++;
+	return cnt;
+}
+
+static uint64_t
+page_cache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page_cache *pc = &hash_entry (e, struct page, hash_elem)->page_cache;
+	return hash_bytes (&pc->inode, sizeof pc->inode) ^ hash_int (pc->index);
+}
+
+static bool
+page_cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page_cache *a = &hash_entry (a_, struct page, hash_elem)->page_cache;
+	const struct page_cache *b = &hash_entry (b_, struct page, hash_elem)->page_cache;
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->index < b->index;
+}
+
 /* The initializer of file vm */
 void
 pagecache_init (void) {
 	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+	hash_init (&cache, page_cache_hash, page_cache_less, NULL);
+	lock_init (&cache_lock);
+	list_init (&ra_queue);
+	lock_init (&ra_lock);
+	cond_init (&ra_done);
+	cond_init (&flush_done);
+	sema_init (&ra_sema, 0);
+	page_cache_workerd = thread_create ("kworkerd", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
+	thread_create ("kflushd", PRI_DEFAULT, page_cache_flushd, NULL);
 }
 
 /* Initialize the page cache */
 bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
+page_cache_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &page_cache_op;
-
+	struct page_cache *pc = &page->page_cache;
+	pc->valid = 0;
+	pc->dirty = 0;
+	pc->ra = 0;
+	pc->accessed = false;
+	lock_init (&pc->lock);
+	return true;
 }
 
 /* Utilze the Swap in mechanism to implement readhead */
 static bool
-page_cache_readahead (struct page *page, void *kva) {
+page_cache_readahead (struct page *page, void *kva UNUSED) {
+	/* The page just got a frame: its sectors are read in as they are
+	 * used. */
+	struct page_cache *pc = &page->page_cache;
+	ASSERT (pc->dirty == 0);
+	ra_waste_cnt += bit_cnt (pc->ra);
+	pc->valid = 0;
+	pc->ra = 0;
+	return true;
 }
 
 /* Utilze the Swap out mechanism to implement writeback */
 static bool
 page_cache_writeback (struct page *page) {
+	struct page_cache *pc = &page->page_cache;
+	const void *buffers[PAGE_CACHE_SECTORS];
+	uint8_t dirty;
+	size_t i, cnt;
+
+	/* A sector written to from now on is dirty again. */
+	lock_acquire (&pc->lock);
+	dirty = pc->dirty;
+	pc->dirty = 0;
+	lock_release (&pc->lock);
+
+	/* One request for each run of dirty sectors adjacent on disk. */
+	for (i = 0; i < PAGE_CACHE_SECTORS; i += cnt) {
+		cnt = 1;
+		if (!(dirty & (1 << i)))
+			continue;
+		buffers[0] = page->frame->kva + i * DISK_SECTOR_SIZE;
+		while (i + cnt < PAGE_CACHE_SECTORS && (dirty & (1 << (i + cnt)))
+				&& pc->sectors[i + cnt] == pc->sectors[i] + cnt) {
+			buffers[cnt] = page->frame->kva + (i + cnt) * DISK_SECTOR_SIZE;
+			cnt++;
+		}
+		disk_write_multiple (filesys_disk, pc->sectors[i], cnt, buffers);
+		writeback_cnt += cnt;
+	}
+	return true;
 }
 
 /* Destory the page_cache. */
 static void
-page_cache_destroy (struct page *page) {
+page_cache_destroy (struct page *page UNUSED) {
 }
 
 /* Worker thread for page cache */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_kworkerd (void *aux UNUSED) {
+	for (;;) {
+		struct ra_request *req;
+
+		sema_down (&ra_sema);
+		lock_acquire (&ra_lock);
+		if (list_empty (&ra_queue)) {
+			/* Cancelled by page_cache_close(). */
+			lock_release (&ra_lock);
+			continue;
+		}
+		req = list_entry (list_pop_front (&ra_queue), struct ra_request, elem);
+		ra_queue_len--;
+		ra_busy = req->inode;
+		lock_release (&ra_lock);
+
+		inode_prefetch (req->inode, req->start, req->end);
+
+		lock_acquire (&ra_lock);
+		ra_busy = NULL;
+		cond_broadcast (&ra_done, &ra_lock);
+		lock_release (&ra_lock);
+		free (req);
+	}
+}
+
+/* Returns the page of INODE's data that holds byte OFFSET, with a frame
+ * that stays put until vm_page_unpin(). Returns NULL if out of memory.
+ * No lock is held while the frame is found, as that may evict another
+ * page of the cache. */
+static struct page *
+page_cache_get (struct inode *inode, off_t offset) {
+	struct page key;
+	struct page *page;
+	struct hash_elem *e;
+
+	key.page_cache.inode = inode;
+	key.page_cache.index = offset / PGSIZE;
+	lock_acquire (&cache_lock);
+	e = hash_find (&cache, &key.hash_elem);
+	if (e != NULL)
+		page = hash_entry (e, struct page, hash_elem);
+	else {
+		page = malloc (sizeof *page);
+		if (page == NULL) {
+			lock_release (&cache_lock);
+			return NULL;
+		}
+		page->va = NULL;
+		page->frame = NULL;
+		page->writable = true;
+		page->owner = NULL;
+		page->readahead = false;
+		page_cache_initializer (page, VM_PAGE_CACHE, NULL);
+		page->page_cache.inode = inode;
+		page->page_cache.index = key.page_cache.index;
+		hash_insert (&cache, &page->hash_elem);
+		list_push_back (&inode->cache_pages, &page->page_cache.inode_elem);
+	}
+	lock_release (&cache_lock);
+
+	vm_page_pin (page);
+	return page;
+}
+
+/* Makes sector SLOT of PAGE, which is at SECTOR on disk, valid. Reads it
+ * in unless it is going to be overwritten as a whole. The sectors of the
+ * page around SLOT that are in the same cluster, and so adjacent on disk,
+ * are read in the same request while they are missing too. */
+static void
+page_cache_fill (struct page *page, size_t slot, disk_sector_t sector,
+		bool overwrite) {
+	struct page_cache *pc = &page->page_cache;
+	size_t spc = fat_sectors_per_cluster ();
+	size_t fsec = pc->index * PAGE_CACHE_SECTORS + slot;
+	size_t lo = slot, hi = slot + 1, i;
+	void *buffers[PAGE_CACHE_SECTORS];
+
+	lock_acquire (&pc->lock);
+	if (pc->valid & (1 << slot)) {
+		hit_cnt++;
+		if (pc->ra & (1 << slot)) {
+			ra_hit_cnt++;
+			pc->ra &= ~(1 << slot);
+		}
+	} else {
+		if (!overwrite) {
+			while (lo > 0 && (fsec - (slot - lo)) % spc != 0
+					&& !(pc->valid & (1 << (lo - 1))))
+				lo--;
+			while (hi < PAGE_CACHE_SECTORS && (fsec + (hi - slot)) % spc != 0
+					&& !(pc->valid & (1 << hi)))
+				hi++;
+			for (i = lo; i < hi; i++)
+				buffers[i - lo] = page->frame->kva + i * DISK_SECTOR_SIZE;
+			disk_read_multiple (filesys_disk, sector - (slot - lo), hi - lo,
+					buffers);
+			miss_cnt++;
+		} else
+			lo = slot, hi = slot + 1;
+		for (i = lo; i < hi; i++) {
+			pc->sectors[i] = sector - slot + i;
+			pc->valid |= 1 << i;
+		}
+	}
+	lock_release (&pc->lock);
+}
+
+/* Makes the CNT sectors of INODE from byte OFFSET on, which must be
+ * sector aligned and are at SECTOR on disk onward, zeros. Nothing is
+ * read or written: the zeros reach the disk when the pages are written
+ * back. Returns false if out of memory. */
+bool
+page_cache_zero (struct inode *inode, off_t offset, disk_sector_t sector,
+		size_t cnt) {
+	ASSERT (offset % DISK_SECTOR_SIZE == 0);
+	while (cnt > 0) {
+		struct page *page = page_cache_get (inode, offset);
+		struct page_cache *pc;
+		size_t slot = offset / DISK_SECTOR_SIZE % PAGE_CACHE_SECTORS;
+
+		if (page == NULL)
+			return false;
+		pc = &page->page_cache;
+		lock_acquire (&pc->lock);
+		for (; cnt > 0 && slot < PAGE_CACHE_SECTORS; slot++, cnt--) {
+			memset (page->frame->kva + slot * DISK_SECTOR_SIZE, 0,
+					DISK_SECTOR_SIZE);
+			pc->sectors[slot] = sector++;
+			pc->valid |= 1 << slot;
+			pc->ra &= ~(1 << slot);
+			if (pc->dirty == 0)
+				pc->dirty_since = timer_ticks ();
+			pc->dirty |= 1 << slot;
+			offset += DISK_SECTOR_SIZE;
+		}
+		lock_release (&pc->lock);
+		vm_page_unpin (page);
+	}
+	return true;
+}
+
+/* Reads the CNT sectors of INODE from byte OFFSET on, which must be in
+ * one page, into the cache, unless they are there already. SECTORS are
+ * where they are on disk. Returns false if out of memory. */
+bool
+page_cache_prefetch (struct inode *inode, off_t offset,
+		const disk_sector_t sectors[], size_t cnt) {
+	struct page *page = page_cache_get (inode, offset);
+	struct page_cache *pc;
+	size_t first = offset / DISK_SECTOR_SIZE % PAGE_CACHE_SECTORS;
+	size_t i, run;
+
+	ASSERT (first + cnt <= PAGE_CACHE_SECTORS);
+	if (page == NULL)
+		return false;
+	pc = &page->page_cache;
+	lock_acquire (&pc->lock);
+	/* One request for each run of missing sectors adjacent on disk. */
+	for (i = 0; i < cnt; i += run) {
+		void *buffers[PAGE_CACHE_SECTORS];
+
+		run = 1;
+		if (pc->valid & (1 << (first + i)))
+			continue;
+		buffers[0] = page->frame->kva + (first + i) * DISK_SECTOR_SIZE;
+		while (i + run < cnt && !(pc->valid & (1 << (first + i + run)))
+				&& sectors[i + run] == sectors[i] + run) {
+			buffers[run] = page->frame->kva
+				+ (first + i + run) * DISK_SECTOR_SIZE;
+			run++;
+		}
+		disk_read_multiple (filesys_disk, sectors[i], run, buffers);
+		for (size_t j = i; j < i + run; j++) {
+			pc->sectors[first + j] = sectors[j];
+			pc->valid |= 1 << (first + j);
+			pc->ra |= 1 << (first + j);
+		}
+		ra_cnt += run;
+	}
+	lock_release (&pc->lock);
+	vm_page_unpin (page);
+	return true;
+}
+
+/* Reads the data of INODE between START and END into the cache in the
+ * background. */
+void
+page_cache_readahead_async (struct inode *inode, off_t start, off_t end) {
+	struct ra_request *req;
+
+	lock_acquire (&ra_lock);
+	if (ra_queue_len >= RA_QUEUE_MAX || (req = malloc (sizeof *req)) == NULL) {
+		lock_release (&ra_lock);
+		return;
+	}
+	req->inode = inode;
+	req->start = start;
+	req->end = end;
+	list_push_back (&ra_queue, &req->elem);
+	ra_queue_len++;
+	lock_release (&ra_lock);
+	sema_up (&ra_sema);
+}
+
+/* Reads SIZE bytes at OFFSET in INODE, which must not cross a sector
+ * boundary, into BUFFER. SECTOR is where that sector of INODE is on
+ * disk. Returns false if out of memory. */
+bool
+page_cache_read (struct inode *inode, off_t offset, disk_sector_t sector,
+		void *buffer, int size) {
+	struct page *page = page_cache_get (inode, offset);
+	size_t slot = offset / DISK_SECTOR_SIZE % PAGE_CACHE_SECTORS;
+
+	ASSERT (offset % DISK_SECTOR_SIZE + size <= DISK_SECTOR_SIZE);
+	if (page == NULL)
+		return false;
+	page_cache_fill (page, slot, sector, false);
+	/* Not under the lock: BUFFER may be user memory that faults. */
+	memcpy (buffer, page->frame->kva + slot * DISK_SECTOR_SIZE
+			+ offset % DISK_SECTOR_SIZE, size);
+	page->page_cache.accessed = true;
+	vm_page_unpin (page);
+	return true;
+}
+
+/* Writes SIZE bytes from BUFFER at OFFSET in INODE, which must not cross
+ * a sector boundary. SECTOR is where that sector of INODE is on disk.
+ * The data reaches the disk when the page is written back. Returns false
+ * if out of memory. */
+bool
+page_cache_write (struct inode *inode, off_t offset, disk_sector_t sector,
+		const void *buffer, int size) {
+	struct page *page = page_cache_get (inode, offset);
+	struct page_cache *pc;
+	size_t slot = offset / DISK_SECTOR_SIZE % PAGE_CACHE_SECTORS;
+
+	ASSERT (offset % DISK_SECTOR_SIZE + size <= DISK_SECTOR_SIZE);
+	if (page == NULL)
+		return false;
+	pc = &page->page_cache;
+	page_cache_fill (page, slot, sector, size == DISK_SECTOR_SIZE);
+	memcpy (page->frame->kva + slot * DISK_SECTOR_SIZE
+			+ offset % DISK_SECTOR_SIZE, buffer, size);
+	/* Marked dirty only now, so that a write back cannot take the sector
+	 * before the copy is done. */
+	lock_acquire (&pc->lock);
+	if (pc->dirty == 0)
+		pc->dirty_since = timer_ticks ();
+	pc->dirty |= 1 << slot;
+	pc->accessed = true;
+	lock_release (&pc->lock);
+	vm_page_unpin (page);
+	return true;
+}
+
+/* Drops the pages of INODE, which nobody has open anymore, from the
+ * cache. Their dirty data is written back unless INODE was removed. */
+void
+page_cache_close (struct inode *inode) {
+	struct list_elem *e;
+
+	/* Cancel read-ahead, and wait for the one under way, before the
+	 * locks it needs are taken. */
+	lock_acquire (&ra_lock);
+	for (e = list_begin (&ra_queue); e != list_end (&ra_queue);) {
+		struct ra_request *req = list_entry (e, struct ra_request, elem);
+		e = list_next (e);
+		if (req->inode == inode) {
+			list_remove (&req->elem);
+			ra_queue_len--;
+			free (req);
+		}
+	}
+	while (ra_busy == inode)
+		cond_wait (&ra_done, &ra_lock);
+	lock_release (&ra_lock);
+
+	lock_acquire (&cache_lock);
+	while (flush_busy)
+		cond_wait (&flush_done, &cache_lock);
+	while (!list_empty (&inode->cache_pages)) {
+		struct page *page = list_entry (list_pop_front (&inode->cache_pages),
+				struct page, page_cache.inode_elem);
+		hash_delete (&cache, &page->hash_elem);
+		ra_waste_cnt += bit_cnt (page->page_cache.ra);
+		vm_page_drop (page, !inode->removed);
+		free (page);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Writes back the CNT pages in PAGES, which are pinned, and unpins
+ * them. Called without cache_lock, so that reads and writes go on
+ * during the writes. */
+static void
+page_cache_sync_pinned (struct page *pages[], size_t cnt) {
+	for (size_t i = 0; i < cnt; i++) {
+		vm_page_sync (pages[i]);
+		vm_page_unpin (pages[i]);
+	}
+}
+
+/* Writes the dirty data of INODE back to disk. */
+void
+page_cache_sync (struct inode *inode) {
+	struct list_elem *e;
+	struct page **pages;
+	size_t cnt = 0;
+
+	lock_acquire (&cache_lock);
+	pages = malloc (list_size (&inode->cache_pages) * sizeof *pages);
+	if (pages == NULL) {
+		/* Out of memory: write back with the lock held. */
+		for (e = list_begin (&inode->cache_pages);
+				e != list_end (&inode->cache_pages); e = list_next (e))
+			vm_page_sync (list_entry (e, struct page, page_cache.inode_elem));
+		lock_release (&cache_lock);
+		return;
+	}
+	for (e = list_begin (&inode->cache_pages); e != list_end (&inode->cache_pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, page_cache.inode_elem);
+		if (page->page_cache.dirty != 0 && vm_page_pin_resident (page))
+			pages[cnt++] = page;
+	}
+	lock_release (&cache_lock);
+	page_cache_sync_pinned (pages, cnt);
+	free (pages);
+}
+
+/* Flusher thread: writes dirty data back in the background. The pages
+ * to write are picked, and pinned, under cache_lock; the writes are done
+ * without it. */
+static void
+page_cache_flushd (void *aux UNUSED) {
+	for (;;) {
+		struct hash_iterator i;
+		size_t page_cnt = 0, dirty_cnt = 0, cnt = 0;
+		struct page **pages = NULL;
+		int64_t now;
+		bool all;
+
+		timer_sleep (FLUSH_INTERVAL);
+		lock_acquire (&cache_lock);
+		hash_first (&i, &cache);
+		while (hash_next (&i)) {
+			struct page *page = hash_entry (hash_cur (&i), struct page, hash_elem);
+			page_cnt++;
+			if (page->page_cache.dirty != 0)
+				dirty_cnt++;
+		}
+		all = dirty_cnt * 100 > page_cnt * FLUSH_DIRTY_RATIO;
+		now = timer_ticks ();
+		if (dirty_cnt > 0)
+			pages = malloc (dirty_cnt * sizeof *pages);
+		hash_first (&i, &cache);
+		while (pages != NULL && cnt < dirty_cnt && hash_next (&i)) {
+			struct page *page = hash_entry (hash_cur (&i), struct page, hash_elem);
+			struct page_cache *pc = &page->page_cache;
+			if (pc->dirty != 0 && (all || now - pc->dirty_since >= FLUSH_AGE)
+					&& vm_page_pin_resident (page))
+				pages[cnt++] = page;
+		}
+		/* page_cache_close() waits for the pages to be unpinned. */
+		flush_busy = cnt > 0;
+		lock_release (&cache_lock);
+
+		page_cache_sync_pinned (pages, cnt);
+		flush_cnt += cnt;
+		if (cnt > 0) {
+			lock_acquire (&cache_lock);
+			flush_busy = false;
+			cond_broadcast (&flush_done, &cache_lock);
+			lock_release (&cache_lock);
+		}
+		free (pages);
+		fat_flush ();
+	}
+}
+
+/* Writes all dirty data in the cache back to disk. */
+void
+page_cache_flush (void) {
+	struct hash_iterator i;
+
+	lock_acquire (&cache_lock);
+	hash_first (&i, &cache);
+	while (hash_next (&i))
+		vm_page_sync (hash_entry (hash_cur (&i), struct page, hash_elem));
+	lock_release (&cache_lock);
+}
+
+/* Prints page cache statistics. */
+void
+page_cache_print_stats (void) {
+	printf ("Page cache: %lld hits, %lld misses, %lld sectors written back\n",
+			hit_cnt, miss_cnt, writeback_cnt);
+	printf ("Page cache: %lld sectors read ahead, %lld used, %lld wasted\n",
+			ra_cnt, ra_hit_cnt, ra_waste_cnt);
+	printf ("Page cache: %lld pages written back by flusher\n", flush_cnt);
 }
+#endif /* EFILESYS */
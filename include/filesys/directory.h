@@ -24,6 +24,8 @@ struct dir {
 bool dir_parse(struct dir* current_dir, const char* path_, struct dir** parsed_dir, char** name);
 bool dir_removed(struct dir* dir);
 
+void dir_init (void);
+
 /* Opening and closing directories. */
 bool dir_create (disk_sector_t sector, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -37,5 +39,6 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, disk_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+void dir_forget (disk_sector_t);
 
 #endif /* filesys/directory.h */
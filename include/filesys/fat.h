@@ -14,13 +14,19 @@ typedef uint32_t cluster_t;  /* Index of a cluster within FAT. */
 #define EOChain 0x0FFFFFFF   /* End of cluster chain */
 
 /* Sectors of FAT information. */
-#define SECTORS_PER_CLUSTER 1 /* Number of sectors per cluster */
+#define SECTORS_PER_CLUSTER 1 /* Default number of sectors per cluster */
+#define SECTORS_PER_CLUSTER_MAX 64 /* Largest number of sectors per cluster */
 #define FAT_BOOT_SECTOR 0     /* FAT boot sector. */
 #define ROOT_DIR_CLUSTER 1    /* Cluster for the root directory */
 
+/* Sectors per cluster of a newly formatted disk. */
+extern unsigned fat_format_sectors_per_cluster;
+
 void fat_init (void);
 void fat_open (void);
 void fat_close (void);
+void fat_flush (void);
+void fat_flush_chain (cluster_t clst);
 void fat_create (void);
 void fat_close (void);
 
@@ -31,12 +37,20 @@ void fat_remove_chain (
     cluster_t clst, /* Cluster # to be removed */
     cluster_t pclst /* Previous cluster of clst, 0: clst is the start of chain */
 );
+void fat_link (cluster_t clst, cluster_t new);
+cluster_t fat_insert (cluster_t clst);
+size_t fat_reserve (cluster_t clst, size_t cnt);
+void fat_unreserve (cluster_t clst, size_t cnt);
 cluster_t fat_get (cluster_t clst);
 void fat_put (cluster_t clst, cluster_t val);
 disk_sector_t cluster_to_sector (cluster_t clst);
 cluster_t sector_to_cluster (disk_sector_t sect);
+unsigned fat_sectors_per_cluster (void);
+size_t fat_cluster_size (void);
+size_t fat_footprint (void);
 
 cluster_t fat_find_empty();
 bool fat_enough_space(size_t need);
+size_t fat_free_cnt (void);
 
 #endif /* filesys/fat.h */
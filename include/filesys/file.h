@@ -10,6 +10,7 @@ struct file {
 	struct inode *inode;        /* File's inode. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+	struct readahead ra;        /* Read-ahead state. */
 };
 
 /* Opening and closing files. */
@@ -6,5 +6,13 @@ void fsutil_cat (char **argv);
 void fsutil_rm (char **argv);
 void fsutil_put (char **argv);
 void fsutil_get (char **argv);
+void fsutil_fat_bench (char **argv);
+void fsutil_frag (char **argv);
+void fsutil_read_bench (char **argv);
+void fsutil_seq_bench (char **argv);
+void fsutil_open_bench (char **argv);
+void fsutil_dir_bench (char **argv);
+void fsutil_sparse_bench (char **argv);
+void fsutil_multi_bench (char **argv);
 
 #endif /* filesys/fsutil.h */
@@ -2,9 +2,11 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/off_t.h"
 #include "devices/disk.h"
+#include "threads/synch.h"
 #ifdef EFILESYS
 	#include "filesys/directory.h"
 #endif
@@ -17,26 +19,87 @@ enum inode_type {
 	INODE_LINK = 3
 };
 
+/* Most holes an inode can record. */
+#define INODE_HOLE_MAX 60
+
+/* A run of clusters in the data of an inode that has none allocated and
+ * reads as zeros. */
+struct inode_hole {
+	uint32_t idx;                       /* Index in the file of the first. */
+	uint32_t cnt;                       /* Number of clusters. */
+};
+
+/* Most bytes of data an inode can hold itself. */
+#define INODE_INLINE_MAX (124 * sizeof (uint32_t))
+
 /* On-disk inode.
  * Must be exactly DISK_SECTOR_SIZE bytes long. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
+	disk_sector_t start;                /* First data sector, 0 if the
+	                                       data is inline. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
 	enum inode_type type;
-	char target[124 * sizeof(uint32_t) / sizeof(char)];               /* Not used. */
+	union {
+		char target[124 * sizeof(uint32_t) / sizeof(char)]; /* Link target. */
+		uint8_t inline_data[INODE_INLINE_MAX]; /* Inline data. */
+		struct {
+			disk_sector_t index;        /* Directory: inode of its hash
+			                               index, 0 if it has none. */
+			uint32_t hole_cnt;          /* Number of holes. */
+			struct inode_hole holes[INODE_HOLE_MAX]; /* In file order. */
+			uint32_t unwritten;         /* Nonzero until the first write:
+			                               the first cluster is not
+			                               zeroed and reads as zeros. */
+		};
+	};
+};
+
+/* A run of adjacent clusters in the data of an inode. */
+struct inode_extent {
+	uint32_t idx;                       /* Index in the file of the first. */
+	uint32_t clst;                      /* First cluster. */
+	uint32_t cnt;                       /* Number of clusters. */
 };
 
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in open inode table. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
+	bool closing;                       /* Last opener is writing it back. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	struct rwlock rw;                   /* Held for reading by reads and
+	                                       for writing by writes. */
+	unsigned write_cnt;                 /* Number of writes, so that caches
+	                                       of the data can tell it changed. */
+	struct list cache_pages;            /* Pages of the page cache. */
+	uint32_t prealloc;                  /* First cluster preallocated. */
+	size_t prealloc_cnt;                /* Clusters preallocated. */
+	struct inode_extent *extents;       /* Cluster chain read so far, as
+	                                       runs of adjacent clusters. */
+	size_t extent_cnt;                  /* Number of extents. */
+	size_t extent_cap;                  /* Room in extents. */
+	struct lock chain_lock;             /* Guards the three above. */
+	struct lock dir_lock;               /* Serializes changes to the
+	                                       entries of a directory. */
+	bool dirty;                         /* DATA changed since it was
+	                                       last written to disk. */
+	struct inode *index;                /* Open hash index of a directory,
+	                                       or NULL. */
 	struct inode_disk data;             /* Inode content. */
 };
 
+/* Sequential read-ahead state of an open file. All zeros is the initial
+ * state. */
+struct readahead {
+	off_t next;                         /* Where a sequential read starts. */
+	off_t end;                          /* End of the data read ahead. */
+	off_t win;                          /* Bytes to keep read ahead,
+	                                       0 after a random read. */
+};
+
 void inode_init (void);
 bool inode_create (disk_sector_t sector, off_t length, const char* target, enum inode_type type);
 struct inode *inode_open (disk_sector_t);
@@ -45,9 +108,15 @@ disk_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, struct readahead *,
+		off_t size, off_t offset);
+void inode_prefetch (struct inode *, off_t start, off_t end);
+void inode_sync (struct inode *);
+void inode_datasync (struct inode *);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+bool inode_is_inline (const struct inode *);
 
 #endif /* filesys/inode.h */
@@ -1,12 +1,50 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
+#include <list.h>
+#include <stdint.h>
 #include "vm/vm.h"
+#include "devices/disk.h"
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 struct page;
+struct inode;
 enum vm_type;
 
-struct page_cache {};
+/* Sectors of file data in one page of the page cache. */
+#define PAGE_CACHE_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
 
-void page_cache_init (void);
+/* A page of file data. Each sector of it is read in on first use, since
+ * the sectors of a file need not be adjacent on disk. */
+struct page_cache {
+	struct inode *inode;           /* File the page belongs to. */
+	off_t index;                   /* Page number within the file. */
+	disk_sector_t sectors[PAGE_CACHE_SECTORS];  /* Where each sector of
+	                                               the page is on disk. */
+	uint8_t valid;                 /* Sectors holding data, one bit each. */
+	uint8_t dirty;                 /* Sectors to write back, one bit each. */
+	uint8_t ra;                    /* Sectors read ahead and not used yet,
+	                                  one bit each. */
+	bool accessed;                 /* Used since the clock last passed. */
+	int64_t dirty_since;           /* Tick it became dirty, if dirty. */
+	struct lock lock;              /* Serializes filling sectors. */
+	struct list_elem inode_elem;   /* Element in inode's cache_pages. */
+};
+
+void pagecache_init (void);
 bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+bool page_cache_read (struct inode *, off_t offset, disk_sector_t,
+		void *buffer, int size);
+bool page_cache_write (struct inode *, off_t offset, disk_sector_t,
+		const void *buffer, int size);
+bool page_cache_zero (struct inode *, off_t offset, disk_sector_t,
+		size_t cnt);
+bool page_cache_prefetch (struct inode *, off_t offset,
+		const disk_sector_t sectors[], size_t cnt);
+void page_cache_readahead_async (struct inode *, off_t start, off_t end);
+void page_cache_close (struct inode *);
+void page_cache_sync (struct inode *);
+void page_cache_flush (void);
+void page_cache_print_stats (void);
 #endif
@@ -36,6 +36,9 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	SYS_FSYNC,                  /* Write a file back to disk. */
+	SYS_FDATASYNC,              /* Write a file's data back to disk. */
 };
 
 #endif /* lib/syscall-nr.h */
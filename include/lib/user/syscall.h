@@ -49,6 +49,8 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 int symlink (const char* target, const char* linkpath);
+int fsync (int fd);
+int fdatasync (int fd);
 
 static inline void* get_phys_addr (void *user_addr) {
 	void* pa;
@@ -43,6 +43,26 @@ void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 bool cond_order (const struct list_elem *, const struct list_elem *, void *);
 
+/* Reader-writer lock.  Any number of readers may hold it at once,
+   or a single writer.  The writer may also take read holds of its
+   own lock, so code that only reads can be shared by both.  Waiting
+   writers hold back new readers, so that readers cannot starve
+   them. */
+struct rwlock {
+	struct lock lock;           /* Protects the fields below. */
+	struct condition cond;      /* Signaled when the lock frees up. */
+	unsigned readers;           /* Number of read holds. */
+	unsigned writers_waiting;   /* Number of writers waiting. */
+	struct thread *writer;      /* Thread holding it for writing. */
+};
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
 /* Optimization barrier.
  *
  * The compiler will not reorder operations across an
@@ -150,6 +150,9 @@ struct thread {
 	struct supplemental_page_table spt;
 	void* stack_bottom;
 	void* rsp;
+	void *fault_around_next;            /* Fault that continues the last
+	                                       fault-around. */
+	size_t fault_around_win;            /* Pages to map on a file fault. */
 #endif
 #ifdef EFILESYS
 	struct dir* curr_dir;
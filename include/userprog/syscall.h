@@ -36,11 +36,11 @@ bool readdirr(int fd, char* name);
 bool isdirr(int fd);
 int inumberr(int fd);
 int symlinkk (const char* target, const char* linkpath);
+int fsyncc(int fd);
+int fdatasyncc(int fd);
 // int mountt();
 // int umountt();
 
-struct lock lock_file;
-
 struct fm* get_fm(int fd);
 bool is_not_mapped(uint64_t va);
 void close_fm(struct fm* fm);
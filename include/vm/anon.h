@@ -2,17 +2,30 @@
 #define VM_ANON_H
 #include "vm/vm.h"
 #include "bitmap.h"
+#include "vm/zswap.h"
 
 struct page;
 enum vm_type;
 
+/* Most pages swapped out by one anon_swap_out_cluster() request. */
+#define SWAP_CLUSTER_MAX 8
+
 struct anon_page {
     size_t swap_idx;
     bool swapped_out;
+    struct zswap_entry *zentry;    /* Compressed copy of a swapped out
+                                      page, or NULL if it is on disk. */
+    bool zero;                     /* Swapped out page known to be all
+                                      zeros; it has no slot or copy. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_copy_swapped (struct page *page, void *aux);
+bool anon_swap_out_cluster (struct page *pages[], size_t cnt);
+bool anon_swap_in_cluster (struct page *pages[], void *kvas[], size_t cnt);
+bool anon_in_swap_slot (const struct page *page);
+void anon_print_stats (void);
 // struct bitmap* swap_table;
 
 #endif
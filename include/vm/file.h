@@ -10,6 +10,7 @@ struct file_page {
 	struct file* fp;
 	size_t size;
 	off_t ofs;
+	void *map_addr;     /* Start of the mmap() mapping, NULL for code. */
 };
 
 bool lazy_load_segment__ (struct page *page, void *aux);
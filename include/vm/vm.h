@@ -12,6 +12,8 @@ struct aux {
 	off_t ofs;
 	uint32_t page_read_bytes;
 	uint32_t page_zero_bytes;
+	void *map_addr;                     /* Start of the mmap() mapping,
+	                                       NULL for program code. */
 };
 
 enum vm_type {
@@ -30,6 +32,8 @@ enum vm_type {
 	 * markers, until the value is fit in the int. */
 	VM_STACK = (1 << 3),
 	VM_MARKER_1 = (1 << 4),
+	/* Uninit page loaded from a file as described by its struct aux. */
+	VM_FROM_FILE = (1 << 5),
 
 	/* DO NOT EXCEED THIS VALUE. */
 	VM_MARKER_END = (1 << 31),
@@ -59,6 +63,10 @@ struct page {
 	/* Your implementation */
 	struct hash_elem hash_elem;
 	bool writable;
+	struct thread *owner;          /* Thread whose spt holds the page. */
+	struct list_elem share_elem;   /* Element in frame's pages list. */
+	bool readahead;                /* Read around from swap, not mapped
+	                                  until the first access. */
 
 	// size_t swap_idx;
 
@@ -77,10 +85,33 @@ struct page {
 /* The representation of "frame" */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct page *page;     /* First of the pages mapped to the frame. */
+	struct list pages;     /* All pages mapped to the frame. More than one
+	                          page shares the frame copy-on-write or
+	                          through the text cache. */
 	struct list_elem frame_elem;	
+	int pin_cnt;           /* Never evicted while greater than 0. */
+	bool io;               /* I/O under way without frame_lock. */
+
+	/* Text cache. INODE is NULL if the frame is not in it. */
+	struct inode *inode;   /* File the data was read from. */
+	off_t ofs;             /* Offset in the file. */
+	size_t size;           /* Bytes read; the rest of the frame is zeros. */
+	unsigned write_cnt;    /* inode->write_cnt when read. */
+	struct hash_elem cache_elem;   /* Element in text cache. */
+	struct text_cache_orphan *orphan;  /* Closes INODE once removed. */
 };
 
+/* Frame eviction policies, selected with the -evict kernel option. */
+enum vm_evict_policy {
+	VM_EVICT_FIFO,         /* Evict the oldest frame. */
+	VM_EVICT_CLOCK,        /* Second chance on accessed bits, clean first. */
+};
+
+extern enum vm_evict_policy vm_evict_policy;
+extern size_t vm_swap_ra_max;
+extern size_t vm_fault_around_max;
+
 /* The function table for page operations.
  * This is one way of implementing "interface" in C.
  * Put the table of "method" into the struct's member, and
@@ -115,6 +146,7 @@ bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
 void vm_init (void);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -124,6 +156,13 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+bool vm_break_cow (struct page *page);
+void vm_page_pin (struct page *page);
+void vm_page_unpin (struct page *page);
+bool vm_page_pin_resident (struct page *page);
+struct page *vm_pin_user (void *va, bool write);
+void vm_page_sync (struct page *page);
+void vm_page_drop (struct page *page, bool sync);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
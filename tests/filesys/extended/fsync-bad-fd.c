@@ -0,0 +1,34 @@
+/* Calls fsync() and fdatasync() on file descriptors that were never
+   opened or are already closed, which must fail. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static void
+check_bad_fd (int fd, const char *what) 
+{
+  int retval;
+
+  retval = fsync (fd);
+  CHECK (retval == -1, "fsync %s (must return -1, actually %d)",
+         what, retval);
+  retval = fdatasync (fd);
+  CHECK (retval == -1, "fdatasync %s (must return -1, actually %d)",
+         what, retval);
+}
+
+void
+test_main (void) 
+{
+  int fd;
+
+  check_bad_fd (-1, "-1");
+  check_bad_fd (1234, "1234");
+
+  CHECK (create ("testfile", 0), "create \"testfile\"");
+  CHECK ((fd = open ("testfile")) > 1, "open \"testfile\"");
+  msg ("close \"testfile\"");
+  close (fd);
+  check_bad_fd (fd, "closed fd");
+}
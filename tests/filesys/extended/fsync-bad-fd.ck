@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync-bad-fd) begin
+(fsync-bad-fd) fsync -1 (must return -1, actually -1)
+(fsync-bad-fd) fdatasync -1 (must return -1, actually -1)
+(fsync-bad-fd) fsync 1234 (must return -1, actually -1)
+(fsync-bad-fd) fdatasync 1234 (must return -1, actually -1)
+(fsync-bad-fd) create "testfile"
+(fsync-bad-fd) open "testfile"
+(fsync-bad-fd) close "testfile"
+(fsync-bad-fd) fsync closed fd (must return -1, actually -1)
+(fsync-bad-fd) fdatasync closed fd (must return -1, actually -1)
+(fsync-bad-fd) end
+EOF
+pass;
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({'xyzzy' => {'a' => ["\0" x 512]}});
+pass;
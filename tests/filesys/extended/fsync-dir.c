@@ -0,0 +1,20 @@
+/* Opens a directory and calls fsync() and fdatasync() on it, which
+   must succeed. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int fd;
+
+  CHECK (mkdir ("xyzzy"), "mkdir \"xyzzy\"");
+  CHECK (create ("xyzzy/a", 512), "create \"xyzzy/a\"");
+  CHECK ((fd = open ("xyzzy")) > 1, "open \"xyzzy\"");
+  CHECK (fsync (fd) == 0, "fsync \"xyzzy\"");
+  CHECK (fdatasync (fd) == 0, "fdatasync \"xyzzy\"");
+  msg ("close \"xyzzy\"");
+  close (fd);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync-dir) begin
+(fsync-dir) mkdir "xyzzy"
+(fsync-dir) create "xyzzy/a"
+(fsync-dir) open "xyzzy"
+(fsync-dir) fsync "xyzzy"
+(fsync-dir) fdatasync "xyzzy"
+(fsync-dir) close "xyzzy"
+(fsync-dir) end
+EOF
+pass;
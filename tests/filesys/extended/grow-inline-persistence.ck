@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($data) = random_bytes (510);
+check_archive ({
+    "a" => [$data],
+    "b" => [substr ($data, 0, 496)],
+    "c" => ["\0" x 300 . substr ($data, 0, 100)]
+});
+pass;
@@ -0,0 +1,57 @@
+/* Grows files around the 496 bytes of data that fit in the inode
+   sector: one across the limit, 490 bytes and then 20, one right
+   at the limit, and one written past its end, leaving a gap within
+   the limit. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[510];
+static char gap[400];
+
+static void
+write_at (const char *file_name, int fd, const char *data, size_t size)
+{
+  int retval = write (fd, data, size);
+  if (retval != (int) size)
+    fail ("write %zu bytes to \"%s\" returned %d", size, file_name, retval);
+}
+
+void
+test_main (void) 
+{
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  msg ("write 490 bytes and then 20 to \"a\"");
+  write_at ("a", fd, buf, 490);
+  write_at ("a", fd, buf + 490, 20);
+  msg ("close \"a\"");
+  close (fd);
+  check_file ("a", buf, 510);
+
+  CHECK (create ("b", 0), "create \"b\"");
+  CHECK ((fd = open ("b")) > 1, "open \"b\"");
+  msg ("write 496 bytes to \"b\"");
+  write_at ("b", fd, buf, 496);
+  msg ("close \"b\"");
+  close (fd);
+  check_file ("b", buf, 496);
+
+  CHECK (create ("c", 0), "create \"c\"");
+  CHECK ((fd = open ("c")) > 1, "open \"c\"");
+  msg ("seek \"c\" to 300 and write 100 bytes");
+  seek (fd, 300);
+  write_at ("c", fd, buf, 100);
+  msg ("close \"c\"");
+  close (fd);
+  memcpy (gap + 300, buf, 100);
+  check_file ("c", gap, sizeof gap);
+}
@@ -0,0 +1,30 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-inline) begin
+(grow-inline) create "a"
+(grow-inline) open "a"
+(grow-inline) write 490 bytes and then 20 to "a"
+(grow-inline) close "a"
+(grow-inline) open "a" for verification
+(grow-inline) verified contents of "a"
+(grow-inline) close "a"
+(grow-inline) create "b"
+(grow-inline) open "b"
+(grow-inline) write 496 bytes to "b"
+(grow-inline) close "b"
+(grow-inline) open "b" for verification
+(grow-inline) verified contents of "b"
+(grow-inline) close "b"
+(grow-inline) create "c"
+(grow-inline) open "c"
+(grow-inline) seek "c" to 300 and write 100 bytes
+(grow-inline) close "c"
+(grow-inline) open "c" for verification
+(grow-inline) verified contents of "c"
+(grow-inline) close "c"
+(grow-inline) end
+EOF
+pass;
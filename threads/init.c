@@ -37,6 +37,9 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef EFILESYS
+#include "filesys/fat.h"
+#endif
 
 /* Page-map-level-4 with kernel mappings only. */
 uint64_t *base_pml4;
@@ -216,6 +219,15 @@ parse_options (char **argv) {
 #ifdef FILESYS
 		else if (!strcmp (name, "-f"))
 			format_filesys = true;
+#endif
+#ifdef EFILESYS
+		else if (!strcmp (name, "-cluster")) {
+			int spc = value != NULL ? atoi (value) : 0;
+			if (spc < 1 || spc > SECTORS_PER_CLUSTER_MAX || (spc & (spc - 1)))
+				PANIC ("bad cluster size `%s' (1 to %d sectors, a power of 2)",
+						value, SECTORS_PER_CLUSTER_MAX);
+			fat_format_sectors_per_cluster = spc;
+		}
 #endif
 		else if (!strcmp (name, "-rs"))
 			random_init (atoi (value));
@@ -226,6 +238,22 @@ parse_options (char **argv) {
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-evict")) {
+			if (value != NULL && !strcmp (value, "fifo"))
+				vm_evict_policy = VM_EVICT_FIFO;
+			else if (value != NULL && !strcmp (value, "clock"))
+				vm_evict_policy = VM_EVICT_CLOCK;
+			else
+				PANIC ("unknown eviction policy `%s'", value);
+		}
+		else if (!strcmp (name, "-swap-ra"))
+			vm_swap_ra_max = atoi (value);
+		else if (!strcmp (name, "-fault-around"))
+			vm_fault_around_max = atoi (value);
+		else if (!strcmp (name, "-zswap"))
+			zswap_max_pages = atoi (value);
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -272,6 +300,14 @@ run_actions (char **argv) {
 		{"rm", 2, fsutil_rm},
 		{"put", 2, fsutil_put},
 		{"get", 2, fsutil_get},
+		{"fat-bench", 1, fsutil_fat_bench},
+		{"frag", 1, fsutil_frag},
+		{"read-bench", 1, fsutil_read_bench},
+		{"seq-bench", 1, fsutil_seq_bench},
+		{"open-bench", 1, fsutil_open_bench},
+		{"dir-bench", 1, fsutil_dir_bench},
+		{"sparse-bench", 1, fsutil_sparse_bench},
+		{"multi-bench", 1, fsutil_multi_bench},
 #endif
 		{NULL, 0, NULL},
 	};
@@ -316,6 +352,14 @@ usage (void) {
 			"  ls                 List files in the root directory.\n"
 			"  cat FILE           Print FILE to the console.\n"
 			"  rm FILE            Delete FILE.\n"
+			"  fat-bench          Time filling the disk with clusters.\n"
+			"  frag               Show how fragmented each file is.\n"
+			"  read-bench         Time random reads in an 8 MB file.\n"
+			"  seq-bench          Time writing and reading an 8 MB file.\n"
+			"  open-bench         Time opening inodes with 10,000 open.\n"
+			"  dir-bench          Time 10,000 names in one directory.\n"
+			"  sparse-bench       Time creating and filling a 64 MB sparse file.\n"
+			"  multi-bench        Time 4 threads reading and writing files at once.\n"
 			"Use these actions indirectly via `pintos' -g and -p options:\n"
 			"  put FILE           Put FILE into file system from scratch disk.\n"
 			"  get FILE           Get FILE from file system into scratch disk.\n"
@@ -324,10 +368,19 @@ usage (void) {
 			"  -h                 Print this help message and power off.\n"
 			"  -q                 Power off VM after actions or on panic.\n"
 			"  -f                 Format file system disk during startup.\n"
+#ifdef EFILESYS
+			"  -cluster=SECTORS   Format with SECTORS sectors per cluster.\n"
+#endif
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -evict=POLICY      Evict frames with POLICY (clock, fifo).\n"
+			"  -swap-ra=PAGES     Read around at most PAGES pages on swap-in.\n"
+			"  -fault-around=PAGES Map at most PAGES pages on a file fault.\n"
+			"  -zswap=PAGES       Keep up to PAGES pages of compressed swap.\n"
 #endif
 			);
 	power_off ();
@@ -356,10 +409,16 @@ print_stats (void) {
 	thread_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
+#endif
+#ifdef EFILESYS
+	page_cache_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
@@ -409,4 +409,81 @@ cond_broadcast (struct condition *cond, struct lock *lock) {
 
 	while (!list_empty (&cond->waiters))
 		cond_signal (cond, lock);
-}
\ No newline at end of file
+}
+/* Initializes RW, a reader-writer lock that is initially free. */
+void
+rwlock_init (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_init (&rw->lock);
+	cond_init (&rw->cond);
+	rw->readers = 0;
+	rw->writers_waiting = 0;
+	rw->writer = NULL;
+}
+
+/* Acquires RW for reading, sleeping while another thread holds it
+   for writing or waits to.  Because of the latter, a thread that
+   holds RW for reading must not take it for reading again; the
+   writer may. */
+void
+rwlock_acquire_read (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+
+	lock_acquire (&rw->lock);
+	if (rw->writer != thread_current ())
+		while (rw->writer != NULL || rw->writers_waiting > 0)
+			cond_wait (&rw->cond, &rw->lock);
+	rw->readers++;
+	lock_release (&rw->lock);
+}
+
+/* Releases a read hold of RW. */
+void
+rwlock_release_read (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_acquire (&rw->lock);
+	ASSERT (rw->readers > 0);
+	if (--rw->readers == 0)
+		cond_broadcast (&rw->cond, &rw->lock);
+	lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it.  RW must not already be held by the current thread. */
+void
+rwlock_acquire_write (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+	ASSERT (!rwlock_held_for_write (rw));
+
+	lock_acquire (&rw->lock);
+	rw->writers_waiting++;
+	while (rw->writer != NULL || rw->readers > 0)
+		cond_wait (&rw->cond, &rw->lock);
+	rw->writers_waiting--;
+	rw->writer = thread_current ();
+	lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rwlock_release_write (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (rwlock_held_for_write (rw));
+
+	lock_acquire (&rw->lock);
+	rw->writer = NULL;
+	cond_broadcast (&rw->cond, &rw->lock);
+	lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing. */
+bool
+rwlock_held_for_write (const struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	return rw->writer == thread_current ();
+}
@@ -485,7 +485,6 @@ load (const char *file_name, struct intr_frame *if_, char **argv, int argc) {
 	bool success = false;
 	int i;
 
-	// lock_acquire(&lock_file);
 
 	/* Allocate and activate page directory. */
 	t->pml4 = pml4_create ();
@@ -574,7 +573,6 @@ load (const char *file_name, struct intr_frame *if_, char **argv, int argc) {
 
 done:
 	/* We arrive here whether the load is successful or not. */
-	// lock_release(&lock_file);
 	return success;
 }
 
@@ -766,6 +764,11 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
+	/* One file for the whole segment. */
+	struct file *seg_file = file_reopen(file);
+	if (seg_file == NULL)
+		return false;
+
 	while (read_bytes > 0 || zero_bytes > 0) {
 		/* Do calculate how to fill this page.
 		 * We will read PAGE_READ_BYTES bytes from FILE
@@ -775,12 +778,22 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 
 		/* TODO: Set up aux to pass information to the lazy_load_segment. */
 		struct aux* aux = malloc(sizeof(struct aux));
-		aux->file = file_reopen(file); // file_reopen necessary?
+		if (aux == NULL)
+			return false;
+		aux->file = seg_file;
 		aux->page_read_bytes = page_read_bytes;
 		aux->page_zero_bytes = page_zero_bytes;
 		aux->ofs = ofs;
+		aux->map_addr = NULL;
 
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage, writable, lazy_load_segment, aux)){
+		/* Read-only pages are file-backed so that they can be dropped
+		 * instead of swapped out, and shared through the text cache. */
+		bool ok;
+		if (!writable && page_read_bytes > 0)
+			ok = vm_alloc_page_with_initializer (VM_FILE | VM_FROM_FILE, upage, writable, lazy_load_segment__, aux);
+		else
+			ok = vm_alloc_page_with_initializer (VM_ANON | VM_FROM_FILE, upage, writable, lazy_load_segment, aux);
+		if (!ok){
 			return false;
 		}
 
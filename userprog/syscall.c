@@ -38,8 +38,6 @@ syscall_init (void) {
 	 * mode stack. Therefore, we masked the FLAG_FL. */
 	write_msr(MSR_SYSCALL_MASK,
 			FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
-
-	lock_init(&lock_file);
 }
 
 /* The main system call interface */
@@ -79,6 +77,8 @@ syscall_handler (struct intr_frame *f UNUSED) {
 		case SYS_ISDIR: f->R.rax = isdirr((int) a1); break;
 		case SYS_INUMBER: f->R.rax = inumberr((int) a1); break;
 		case SYS_SYMLINK: f->R.rax = symlinkk((const char*) a1, (const char*) a2); break;
+		case SYS_FSYNC: f->R.rax = fsyncc((int) a1); break;
+		case SYS_FDATASYNC: f->R.rax = fdatasyncc((int) a1); break;
 		// case SYS_MOUNT: mountt(); break;
 		// case SYS_UMOUNT: umountt(); break;
 	}
@@ -120,29 +120,24 @@ int openn(const char *path) {
 	if ( path==NULL || is_not_mapped(path) ) exitt(-1); // null pointer for file name / file name virtual address not mapped
 	if ( path[0]==NULL ) return -1; // empty file
 
-	lock_acquire(&lock_file);
 	enum inode_type type;
 	void* fdp = filesys_open(path, &type); // file pointer or directory pointer
-	lock_release(&lock_file);
 
 	ASSERT(type!=INODE_LINK);
 	
 	if (fdp==NULL) {
-		// lock_release(&lock_file);
 		return -1;
 	}
 
 	struct thread* curr = thread_current();
 
 	if (list_size(&curr->fm_list) > 135) {
-		// lock_release(&lock_file);
 		return -1;
 	}
 
 	// struct fm* new_file_map = palloc_get_page(PAL_USER);
 	struct fm* new_file_map = (struct fm*)malloc(sizeof(struct fm));
 	if (new_file_map==NULL) {
-		// lock_release(&lock_file);
 		return -1;
 	}
 	new_file_map->fd = curr->fd_next;
@@ -152,7 +147,6 @@ int openn(const char *path) {
 	new_file_map->file_exists = true;
 	list_push_back(&curr->fm_list, &new_file_map->elem);
 
-	// lock_release(&lock_file);
 	return curr->fd_next++;
 }
 
@@ -173,21 +167,69 @@ int filesizee(int fd) {
 }
 
 void check_buffer(const void *buffer, unsigned size, bool write) {
-	for (int i = 0; i < size; i+=PGSIZE)
+	for (const void *va = pg_round_down(buffer); va < buffer + size; va += PGSIZE)
 	{
-		if(is_kernel_vaddr(buffer+i)) {
+		if(is_kernel_vaddr(va)) {
 			exitt(-1);
 		}
-		struct page* p = spt_find_page(&thread_current()->spt, buffer+i);
+		struct page* p = spt_find_page(&thread_current()->spt, (void *) va);
 		if (p==NULL) {
 			return;
 		}
 		if (write && !p->writable) {
 			exitt(-1);
 		}
+		// kernel writes do not fault on copy-on-write pages, so copy now
+		if (write && !vm_break_cow(p)) {
+			exitt(-1);
+		}
 	}	
 }
 
+/* Most pages of a user buffer pinned at once by file_io_user(). */
+#define USER_IO_PAGES 16
+
+/* Reads SIZE bytes of FILE into the user BUFFER if TO_USER, else writes
+ * them from BUFFER to FILE. Returns the number of bytes moved.
+ * The pages of BUFFER are pinned, a few at a time, so that copying to or
+ * from them cannot fault while the file is locked. Exits if BUFFER is
+ * not valid user memory. */
+static int
+file_io_user(struct file *file, void *buffer, unsigned size, bool to_user) {
+	int total = 0;
+
+	while (size > 0) {
+		struct page *pages[USER_IO_PAGES];
+		size_t cnt = 0;
+		unsigned chunk = 0;
+		int done;
+
+		while (chunk < size && cnt < USER_IO_PAGES) {
+			void *va = buffer + chunk;
+			pages[cnt] = vm_pin_user(va, to_user);
+			if (pages[cnt] == NULL) {
+				while (cnt > 0)
+					vm_page_unpin(pages[--cnt]);
+				exitt(-1);
+			}
+			cnt++;
+			chunk += PGSIZE - pg_ofs(va);
+		}
+		if (chunk > size)
+			chunk = size;
+		done = to_user ? file_read(file, buffer, chunk)
+			: file_write(file, buffer, chunk);
+		while (cnt > 0)
+			vm_page_unpin(pages[--cnt]);
+		total += done;
+		if (done < (int) chunk)
+			break;
+		buffer += chunk;
+		size -= chunk;
+	}
+	return total;
+}
+
 int readd(int fd, void *buffer, unsigned size) {
 	check_buffer(buffer, size, true);
 	if ( buffer==NULL || is_not_mapped(buffer)) exitt(-1); // null pointer for buffer / buffer virtual address not mapped
@@ -202,9 +244,7 @@ int readd(int fd, void *buffer, unsigned size) {
 	else { // file	
 		struct fm* fm = get_fm(fd);
 		if ( fm==NULL ) exitt(-1); // fd has not been issued (bad)
-		lock_acquire(&lock_file);
-		int size_read = file_read(fm->fdp, buffer, size);
-		lock_release(&lock_file);
+		int size_read = file_io_user(fm->fdp, buffer, size, true);
 		return size_read;
 	}
 }
@@ -225,9 +265,7 @@ int writee(int fd, const void *buffer, unsigned size) {
 	else { // file
 		struct fm* fm = get_fm(fd);
 		if ( fm==NULL || fm->type!=INODE_FILE ) return -1; // fd has not been issued(bad), or it points to a directory
-		lock_acquire(&lock_file);
-		int size_wrote = file_write(fm->fdp, buffer, size);
-		lock_release(&lock_file);
+		int size_wrote = file_io_user(fm->fdp, (void *) buffer, size, false);
 		return size_wrote;
 	}
 }
@@ -368,6 +406,22 @@ int symlinkk (const char* target, const char* linkpath) {
 
 	return 0;
 };
+
+int fsyncc(int fd) {
+	struct fm* fm = get_fm(fd);
+	if (fm==NULL) return -1; // fd has not been issued (bad)
+	struct inode *inode = fm->type==INODE_DIR ? dir_get_inode(fm->fdp) : file_get_inode(fm->fdp);
+	inode_sync(inode);
+	return 0;
+}
+
+int fdatasyncc(int fd) {
+	struct fm* fm = get_fm(fd);
+	if (fm==NULL) return -1; // fd has not been issued (bad)
+	struct inode *inode = fm->type==INODE_DIR ? dir_get_inode(fm->fdp) : file_get_inode(fm->fdp);
+	inode_datasync(inode);
+	return 0;
+}
 #endif
 
 
@@ -2,6 +2,9 @@
 
 #include "vm/vm.h"
 #include "devices/disk.h"
+#include <stdio.h>
+#include <string.h>
+#include "threads/synch.h"
 
 #define BITMAP_ERROR SIZE_MAX
 
@@ -20,12 +23,93 @@ static const struct page_operations anon_ops = {
 };
 struct bitmap* swap_table;
 
+/* Swap slots are page sized. Slots are handed out next-fit from
+ * swap_hint, so that pages evicted together land next to each other on
+ * the swap disk and the table is not rescanned from slot 0 every time. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+static struct lock swap_lock;          /* Guards swap_table, swap_hint. */
+static size_t swap_hint;               /* Where the next scan starts. */
+
+static long long swap_out_cnt;         /* # of pages written to disk. */
+static long long swap_in_cnt;          /* # of pages read from disk. */
+static long long zero_cnt;             /* # of all-zero pages not written. */
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
 	/* TODO: Set up the swap_disk. */
 	swap_disk = disk_get(1, 1);
 	swap_table = bitmap_create(disk_size(swap_disk)*DISK_SECTOR_SIZE/PGSIZE);
+	lock_init(&swap_lock);
+	swap_hint = 0;
+	zswap_init();
+}
+
+/* Allocates CNT adjacent swap slots and returns the first one, or
+ * BITMAP_ERROR if there is no such run. */
+static size_t
+swap_slot_alloc (size_t cnt) {
+	lock_acquire(&swap_lock);
+	size_t slot = bitmap_scan_and_flip(swap_table, swap_hint, cnt, false);
+	if (slot == BITMAP_ERROR && swap_hint != 0)
+		slot = bitmap_scan_and_flip(swap_table, 0, cnt, false);
+	if (slot != BITMAP_ERROR)
+		swap_hint = (slot + cnt) % bitmap_size(swap_table);
+	lock_release(&swap_lock);
+	return slot;
+}
+
+/* Frees the swap slot SLOT. */
+static void
+swap_slot_free (size_t slot) {
+	lock_acquire(&swap_lock);
+	ASSERT(bitmap_test(swap_table, slot));
+	bitmap_reset(swap_table, slot);
+	lock_release(&swap_lock);
+}
+
+/* Moves the CNT pages at KVAS from or to the CNT swap slots starting at
+ * SLOT with a single disk request. */
+static void
+swap_io (size_t slot, size_t cnt, void *kvas[], bool write) {
+	void *sectors[SWAP_CLUSTER_MAX * SECTORS_PER_SLOT];
+
+	ASSERT(cnt > 0 && cnt <= SWAP_CLUSTER_MAX);
+	for (size_t i = 0; i < cnt * SECTORS_PER_SLOT; i++)
+		sectors[i] = kvas[i / SECTORS_PER_SLOT]
+			+ i % SECTORS_PER_SLOT * DISK_SECTOR_SIZE;
+	if (write)
+		disk_write_multiple(swap_disk, slot * SECTORS_PER_SLOT,
+				cnt * SECTORS_PER_SLOT, (const void **) sectors);
+	else
+		disk_read_multiple(swap_disk, slot * SECTORS_PER_SLOT,
+				cnt * SECTORS_PER_SLOT, sectors);
+}
+
+/* Prints swap statistics. */
+void
+anon_print_stats (void) {
+	printf ("Swap: %lld pages out, %lld pages in, %lld zero pages skipped\n",
+			swap_out_cnt, swap_in_cnt, zero_cnt);
+}
+
+/* Returns true if the contents of PAGE, an anonymous page, are in a
+ * swap slot on the swap disk. */
+bool
+anon_in_swap_slot (const struct page *page) {
+	const struct anon_page *anon_page = &page->anon;
+	return anon_page->swapped_out && anon_page->zentry == NULL
+		&& !anon_page->zero;
+}
+
+/* Returns true if the page at KVA holds only zeros. */
+static bool
+page_is_zero (const void *kva) {
+	const uint64_t *p = kva;
+	for (size_t i = 0; i < PGSIZE / sizeof *p; i++)
+		if (p[i] != 0)
+			return false;
+	return true;
 }
 
 /* Initialize the file mapping */
@@ -35,46 +119,123 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 	struct anon_page *anon_page = &page->anon;
 	anon_page->swapped_out = false;
+	anon_page->zentry = NULL;
+	anon_page->zero = false;
 	return true;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
-	// printf("anon swap in\n");
 	struct anon_page *anon_page = &page->anon;
 	if (anon_page->swapped_out == false){
 		ASSERT(0);
 		return true;
 	}
-	size_t swap_idx = anon_page->swap_idx;
-	for (int i=0; i<8; i++){
-		disk_read(swap_disk, swap_idx*8+i, kva+i*DISK_SECTOR_SIZE);
+	if (anon_page->zero) {
+		memset(kva, 0, PGSIZE);
+		anon_page->zero = false;
+		anon_page->swapped_out = false;
+		return true;
 	}
-	bitmap_set(swap_table, swap_idx, 0);
-	anon_page->swapped_out = false;
+	if (anon_page->zentry != NULL) {
+		zswap_load(anon_page->zentry, kva);
+		zswap_free(anon_page->zentry);
+		anon_page->zentry = NULL;
+		anon_page->swapped_out = false;
+		return true;
+	}
+	return anon_swap_in_cluster(&page, &kva, 1);
+}
 
+/* Swaps in the CNT anonymous pages in PAGES into the frames at KVAS with
+ * one disk request. The pages must sit in adjacent swap slots, in order. */
+bool
+anon_swap_in_cluster (struct page *pages[], void *kvas[], size_t cnt) {
+	size_t slot = pages[0]->anon.swap_idx;
+
+	for (size_t i = 0; i < cnt; i++) {
+		ASSERT(anon_in_swap_slot(pages[i]));
+		ASSERT(pages[i]->anon.swap_idx == slot + i);
+	}
+	swap_io(slot, cnt, kvas, false);
+	swap_in_cnt += cnt;
+	for (size_t i = 0; i < cnt; i++) {
+		swap_slot_free(slot + i);
+		pages[i]->anon.swapped_out = false;
+	}
+	return true;
+}
+
+/* Initializer that fills PAGE with the contents of the swapped out page
+ * AUX. The swap slot stays with AUX; this is how a forked child gets its
+ * own copy of a page its parent has swapped out. */
+bool
+anon_copy_swapped (struct page *page, void *aux) {
+	struct anon_page *src = &((struct page *) aux)->anon;
+	ASSERT (src->swapped_out);
+	if (src->zero)
+		memset(page->frame->kva, 0, PGSIZE);
+	else if (src->zentry != NULL)
+		zswap_load(src->zentry, page->frame->kva);
+	else
+		swap_io(src->swap_idx, 1, &page->frame->kva, false);
 	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
-	if (anon_page->swapped_out == true){
-		ASSERT(0);
-		return true;
-	}
-	size_t swap_idx = bitmap_scan(swap_table, 0, 1, 0);
-	if (swap_idx == BITMAP_ERROR){
-		PANIC("bitmap_err");
+	return anon_swap_out_cluster(&page, 1);
+}
+
+/* Swaps out the CNT anonymous pages in PAGES, which must all be in
+ * frames. All-zero pages are only marked as such, and pages that fit in
+ * the compressed swap cache stay in memory; the rest are written to
+ * adjacent swap slots with one disk request.
+ * Falls back to smaller runs when the swap disk is too fragmented. */
+bool
+anon_swap_out_cluster (struct page *pages[], size_t cnt) {
+	struct page *to_disk[SWAP_CLUSTER_MAX];
+	void *kvas[SWAP_CLUSTER_MAX];
+	size_t disk_cnt = 0;
+
+	ASSERT(cnt <= SWAP_CLUSTER_MAX);
+	for (size_t i = 0; i < cnt; i++) {
+		struct anon_page *anon_page = &pages[i]->anon;
+		ASSERT(!anon_page->swapped_out);
+		if (page_is_zero(pages[i]->frame->kva)) {
+			anon_page->zero = true;
+			anon_page->swapped_out = true;
+			zero_cnt++;
+			continue;
+		}
+		anon_page->zentry = zswap_store(pages[i]->frame->kva);
+		if (anon_page->zentry != NULL)
+			anon_page->swapped_out = true;
+		else
+			to_disk[disk_cnt++] = pages[i];
 	}
-	bitmap_set(swap_table, swap_idx, 1);
-	for (int i=0; i<8; i++){
-		disk_write(swap_disk, swap_idx*8 + i, page->frame->kva+i*DISK_SECTOR_SIZE);
+	pages = to_disk;
+	cnt = disk_cnt;
+	while (cnt > 0) {
+		size_t run = cnt;
+		size_t slot;
+		while ((slot = swap_slot_alloc(run)) == BITMAP_ERROR)
+			if ((run /= 2) == 0)
+				PANIC("swap disk full");
+		for (size_t i = 0; i < run; i++) {
+			struct anon_page *anon_page = &pages[i]->anon;
+			ASSERT(!anon_page->swapped_out);
+			kvas[i] = pages[i]->frame->kva;
+			anon_page->swap_idx = slot + i;
+			anon_page->swapped_out = true;
+		}
+		swap_io(slot, run, kvas, true);
+		swap_out_cnt += run;
+		pages += run;
+		cnt -= run;
 	}
-	anon_page->swap_idx = swap_idx;
-	anon_page->swapped_out = true;
 	return true;
 }
 
@@ -82,4 +243,8 @@ anon_swap_out (struct page *page) {
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	if (anon_page->swapped_out && anon_page->zentry != NULL)
+		zswap_free(anon_page->zentry);
+	else if (anon_in_swap_slot(page))
+		swap_slot_free(anon_page->swap_idx);
 }
@@ -1,5 +1,6 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <string.h>
 #include "vm/vm.h"
 #include "lib/user/syscall.h"
 #include "include/userprog/syscall.h"
@@ -32,6 +33,7 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 	file_page->fp = aux->file;
 	file_page->size = aux->page_read_bytes;
 	file_page->ofs = aux->ofs;
+	file_page->map_addr = aux->map_addr;
 	return true;
 }
 
@@ -39,11 +41,10 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
 	// printf("file swap in\n");
-	// lock_acquire(&lock_file);
 	struct file_page *file_page UNUSED = &page->file;
-	struct thread* curr = thread_current();
-	file_read_at(file_page->fp, page->va, file_page->size, file_page->ofs);
-	// lock_release(&lock_file);
+	/* Through KVA, so that reading in does not dirty the page. */
+	file_read_at(file_page->fp, kva, file_page->size, file_page->ofs);
+	memset(kva + file_page->size, 0, PGSIZE - file_page->size);
 	return true;
 }
 
@@ -51,12 +52,14 @@ file_backed_swap_in (struct page *page, void *kva) {
 static bool
 file_backed_swap_out (struct page *page) {
 	struct file_page *file_page UNUSED = &page->file;
-	struct thread* curr = thread_current();
-	if (pml4_is_dirty(curr->pml4, page->va)){
+	uint64_t *pml4 = page->owner->pml4;
+	if (pml4_is_dirty(pml4, page->va)){
+		/* Cleared first: the page may still be mapped, and a write to
+		 * it during the write back dirties it again. */
+		pml4_set_dirty(pml4, page->va, 0);
 		file_write_at(file_page->fp, page->frame->kva, file_page->size, file_page->ofs);
 	}
-	pml4_set_dirty(curr->pml4, page->frame->kva, 0);
-
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
@@ -91,6 +94,7 @@ load_segment__ (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	if (ofs%PGSIZE!=0) return false;
 	// ASSERT (ofs % PGSIZE == 0);
+	void *map_addr = upage;
 
 	while (read_bytes > 0 || zero_bytes > 0) {
 		// 도는 와중에 page가 이미 allocate 되어있으면? 그게 곧 vm_alloc_page~==false 상황인가?
@@ -103,8 +107,9 @@ load_segment__ (struct file *file, off_t ofs, uint8_t *upage,
 		aux->page_read_bytes = page_read_bytes;
 		aux->page_zero_bytes = page_zero_bytes;
 		aux->ofs = ofs;
+		aux->map_addr = map_addr;
 		// printf("Allocating page with read bytes %d and zero bytes %d-----------------\n", page_read_bytes, page_zero_bytes);
-		if (!vm_alloc_page_with_initializer (VM_FILE, upage, writable, lazy_load_segment__, aux)){ // edited
+		if (!vm_alloc_page_with_initializer (VM_FILE | VM_FROM_FILE, upage, writable, lazy_load_segment__, aux)){ // edited
 			return false;
 		}
 
@@ -126,23 +131,46 @@ do_mmap (void *addr, size_t length, int writable, struct file *file, off_t offse
 	return MAP_FAILED;
 }
 
+/* Writes P back to its file if it was written while mapped. It is
+ * written from its pinned frame, so that the write neither faults nor
+ * races eviction while the file is locked. */
 void write_if_dirty(struct page* p) {
-	if (pml4_is_dirty(thread_current()->pml4, p->va)) {
-		// printf("File was dirty---------------------------\n");
-		file_write_at(p->file.fp, p->va, p->file.size, p->file.ofs); // if file was written while mapped in memory
+	uint64_t *pml4 = thread_current()->pml4;
+	if (!vm_page_pin_resident(p))
+		return;  /* Written back when it was evicted. */
+	if (pml4_is_dirty(pml4, p->va)) {
+		pml4_set_dirty(pml4, p->va, false);
+		file_write_at(p->file.fp, p->frame->kva, p->file.size, p->file.ofs); // if file was written while mapped in memory
 	}
+	vm_page_unpin(p);
+}
+
+/* Returns true if P belongs to the mmap() mapping that starts at
+ * MAP_ADDR, whether or not it has been loaded yet. */
+static bool
+page_in_mapping (struct page *p, void *map_addr) {
+	if (page_get_type(p)!=VM_FILE)
+		return false;
+	if (VM_TYPE(p->operations->type)==VM_UNINIT)
+		return ((struct aux *) p->uninit.aux)->map_addr == map_addr;
+	return p->file.map_addr == map_addr;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
 	struct thread* t = thread_current();
+	void *map_addr = addr;
+
+	if (map_addr == NULL)
+		return;
 	while(true) {
 		struct page* p = spt_find_page(&t->spt, addr);
 
+		/* Stops at code pages and at the start of another mapping. */
 		if (
 			p==NULL ||
-			page_get_type(p)!=VM_FILE
+			!page_in_mapping(p, map_addr)
 		) break;
 
 		write_if_dirty(p);
@@ -1,10 +1,86 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
 
 static struct list frame_table;
+static void *zero_kva;                 /* Shared read-only page of zeros. */
+static struct list_elem *clock_hand;   /* Next frame the clock looks at. */
+static struct lock frame_lock;         /* Guards frame table and frames. */
+static struct condition frame_cond;    /* Signaled when frames' I/O ends,
+                                          or frames are unpinned or
+                                          freed. */
+
+enum vm_evict_policy vm_evict_policy = VM_EVICT_CLOCK;
+static long long evict_cnt;            /* # of frames evicted. */
+static long long fault_cnt;            /* # of faults handled. */
+static int64_t fault_ticks;            /* Timer ticks spent handling them. */
+static long long fork_cnt;             /* # of page tables copied by fork. */
+static int64_t fork_ticks;             /* Timer ticks spent copying them. */
+
+/* Page-out daemon. It is woken up when fewer than swapd_low user frames
+ * are free and evicts until swapd_high frames are free again, so that
+ * most faults find a free frame without evicting on their own. */
+#define SWAPD_CLEAN_BATCH 16           /* Frames to pre-clean per run. */
+static struct semaphore swapd_sema;
+static size_t user_frame_cnt;          /* # of frames in the user pool. */
+static size_t frame_cnt;               /* # of frames in frame_table. */
+static size_t swapd_low, swapd_high;   /* Free frame watermarks. */
+static long long direct_reclaim_cnt;   /* # of evictions by faults. */
+static long long swapd_reclaim_cnt;    /* # of evictions by the daemon. */
+static long long swapd_clean_cnt;      /* # of file pages pre-cleaned. */
+
+static void vm_swapd (void *aux);
+static hash_hash_func text_cache_hash;
+static hash_less_func text_cache_less;
+static void text_cache_remove (struct frame *frame);
+
+/* Swap read-around. A fault on a swapped out anonymous page also reads
+ * the following pages that are swapped out to the following slots, up
+ * to a window that grows with the number of read-around pages used since
+ * the last read-around and shrinks when they go unused. Pages read around
+ * are left unmapped, so that their first access is a cheap fault that
+ * tells us the read paid off. */
+size_t vm_swap_ra_max = SWAP_CLUSTER_MAX;  /* Largest window, in pages. */
+static size_t swap_ra_hits;            /* Hits since the last read-around. */
+static size_t swap_ra_prev_win = 1;    /* Window of the last swap-in. */
+static size_t swap_ra_prev_slot;       /* Slot of the last swap-in. */
+static long long swap_ra_cnt;          /* # of pages read around. */
+static long long swap_ra_hit_cnt;      /* # of them used later. */
+
+/* Text cache. Frames holding read-only pages loaded from files are
+ * indexed by file and offset, so that all processes running a program
+ * share one frame for each page of its code. A cached frame stays in the
+ * frame table after its last page goes away, so that the next exec of
+ * the program finds its code in memory; such frames are evicted first.
+ * An entry is dropped once its file is written. */
+static struct hash text_cache;
+static struct list text_cache_orphans; /* Inodes dropped from the cache,
+                                          closed by frame_unlock(). */
+static long long text_cache_hit_cnt;   /* # of pages found in the cache. */
+static long long text_cache_miss_cnt;  /* # of cacheable pages read in. */
+
+/* An inode that the text cache no longer needs. */
+struct text_cache_orphan {
+	struct inode *inode;
+	struct list_elem elem;             /* Element in text_cache_orphans. */
+};
+
+/* Fault-around. A fault on a page loaded from a file also maps the
+ * following pages loaded from the same file, at the following offsets,
+ * reading all of them with one file_read_at(). Each process keeps its
+ * own window, which doubles while its faults pick up where the last
+ * fault-around stopped and halves on other faults. */
+#define FAULT_AROUND_MAX 16            /* Largest possible window. */
+#define FAULT_AROUND_INIT 4            /* Window of a new process. */
+size_t vm_fault_around_max = FAULT_AROUND_MAX;  /* Largest window. */
+static long long fault_around_cnt;     /* # of pages mapped around. */
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -20,6 +96,42 @@ vm_init (void) {
 	/* DO NOT MODIFY UPPER LINES. */
 	/* TODO: Your code goes here. */
 	list_init(&frame_table);
+	clock_hand = list_end(&frame_table);
+	lock_init(&frame_lock);
+	cond_init(&frame_cond);
+	zero_kva = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+	hash_init(&text_cache, text_cache_hash, text_cache_less, NULL);
+	list_init(&text_cache_orphans);
+
+	user_frame_cnt = palloc_user_free_cnt();
+	swapd_low = user_frame_cnt / 32 > 4 ? user_frame_cnt / 32 : 4;
+	swapd_high = swapd_low * 2;
+	sema_init(&swapd_sema, 0);
+	thread_create("kswapd", PRI_DEFAULT, vm_swapd, NULL);
+}
+
+/* Prints virtual memory statistics. */
+void
+vm_print_stats (void) {
+	printf ("VM: %lld evictions (%s), %lld direct, %lld background, "
+			"%lld pre-cleaned\n", evict_cnt,
+			vm_evict_policy == VM_EVICT_CLOCK ? "clock" : "fifo",
+			direct_reclaim_cnt, swapd_reclaim_cnt, swapd_clean_cnt);
+	printf ("VM: %lld faults in %"PRId64" ticks\n", fault_cnt, fault_ticks);
+	printf ("VM: %lld forks copied in %"PRId64" ticks\n", fork_cnt, fork_ticks);
+	printf ("VM: %lld pages read around, %lld used\n",
+			swap_ra_cnt, swap_ra_hit_cnt);
+	printf ("VM: %lld pages mapped by fault-around\n", fault_around_cnt);
+	printf ("VM: text cache %lld hits, %lld misses\n",
+			text_cache_hit_cnt, text_cache_miss_cnt);
+	anon_print_stats ();
+	zswap_print_stats ();
+}
+
+/* Returns the number of free frames in the user pool. */
+static size_t
+vm_free_frame_cnt (void) {
+	return user_frame_cnt > frame_cnt ? user_frame_cnt - frame_cnt : 0;
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -37,9 +149,13 @@ page_get_type (struct page *page) {
 }
 
 /* Helpers */
-static struct frame *vm_get_victim (void);
+static struct frame *vm_get_victim (bool fs);
 static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+static struct frame *vm_evict_frame (bool fs);
+static void vm_free_frame (struct page *page);
+static void vm_free_frame_locked (struct page *page);
+static bool vm_swap_in_around (struct page *page);
+static bool vm_swap_ra_map (struct page *page);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -67,6 +183,8 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 			uninit_new(p, upage, init, type, aux, file_backed_initializer);
 		}
 		p->writable = writable;
+		p->owner = thread_current();
+		p->readahead = false;
 
 		/* TODO: Insert the page into the spt. */
 		if (!spt_insert_page(spt, p)){
@@ -81,19 +199,13 @@ err:
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
 spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	/* TODO: Fill this function. */
-	struct hash_iterator i;
-	if (hash_empty(spt->hash_table)){
-		return NULL;
-	}
-	hash_first (&i, spt->hash_table);
-	while (hash_next (&i)) {
-		struct page *p = hash_entry (hash_cur(&i), struct page, hash_elem);
-		if (p->va==pg_round_down(va)) {
-			return p;
-		}
-	}
-	return NULL;
+	/* Look the page up by key instead of walking every entry, so that
+	 * the cost of a fault does not grow with the size of the spt.
+	 * Only the va of the key page is read by the hash functions. */
+	struct page key;
+	key.va = pg_round_down(va);
+	struct hash_elem *e = hash_find(spt->hash_table, &key.hash_elem);
+	return e != NULL ? hash_entry(e, struct page, hash_elem) : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
@@ -112,64 +224,495 @@ spt_insert_page (struct supplemental_page_table *spt UNUSED,
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
 	ASSERT(pg_ofs(page->va)==0);
-	pml4_clear_page(thread_current()->pml4, page->va);
+	vm_free_frame(page);
 	hash_delete(spt->hash_table, &page->hash_elem);
 	vm_dealloc_page (page);
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Removes FRAME from the frame table, keeping the clock hand valid. */
+static void
+frame_table_remove (struct frame *frame) {
+	struct list_elem *next = list_remove(&frame->frame_elem);
+	if (clock_hand == &frame->frame_elem)
+		clock_hand = next;
+}
+
+/* Returns the frame under the clock hand and advances the hand,
+ * wrapping around at the end of the frame table. */
 static struct frame *
-vm_get_victim (void) {
+clock_advance (void) {
+	if (clock_hand == list_end(&frame_table))
+		clock_hand = list_begin(&frame_table);
+	struct frame *frame = list_entry(clock_hand, struct frame, frame_elem);
+	clock_hand = list_next(clock_hand);
+	return frame;
+}
+
+/* Returns true if more than one page is mapped to FRAME. */
+static bool
+frame_is_shared (struct frame *frame) {
+	return !list_empty(&frame->pages)
+		&& list_begin(&frame->pages) != list_rbegin(&frame->pages);
+}
+
+/* Releases frame_lock, then closes the inodes dropped from the text
+ * cache meanwhile. The last close writes the file back through the page
+ * cache, which takes frame_lock, so it is never done with the lock held.
+ * Must not be called with file system locks held. */
+static void
+frame_unlock (void) {
+	struct list orphans;
+
+	list_init(&orphans);
+	while (!list_empty(&text_cache_orphans))
+		list_push_back(&orphans, list_pop_front(&text_cache_orphans));
+	lock_release(&frame_lock);
+	while (!list_empty(&orphans)) {
+		struct text_cache_orphan *orphan = list_entry(list_pop_front(&orphans),
+				struct text_cache_orphan, elem);
+		inode_close(orphan->inode);
+		free(orphan);
+	}
+}
+
+/* Waits until the frame of PAGE, if any, has no I/O under way. No file
+ * or disk I/O is done with frame_lock held: the frame is marked instead,
+ * and anyone else who needs the page waits here.
+ * Must be called with frame_lock held. */
+static void
+vm_wait_io (struct page *page) {
+	while (page->frame != NULL && page->frame->io)
+		cond_wait(&frame_cond, &frame_lock);
+}
+
+/* Accessed and dirty bits of PAGE, which has a frame. Pages of the page
+ * cache are mapped in no page table, so they keep their own. */
+static bool
+page_is_accessed (struct page *page) {
+#ifdef EFILESYS
+	if (page_get_type(page) == VM_PAGE_CACHE)
+		return page->page_cache.accessed;
+#endif
+	return pml4_is_accessed(page->owner->pml4, page->va);
+}
+
+static void
+page_clear_accessed (struct page *page) {
+#ifdef EFILESYS
+	if (page_get_type(page) == VM_PAGE_CACHE) {
+		page->page_cache.accessed = false;
+		return;
+	}
+#endif
+	pml4_set_accessed(page->owner->pml4, page->va, false);
+}
+
+static bool
+page_is_dirty (struct page *page) {
+#ifdef EFILESYS
+	if (page_get_type(page) == VM_PAGE_CACHE)
+		return page->page_cache.dirty != 0;
+#endif
+	return pml4_is_dirty(page->owner->pml4, page->va);
+}
+
+/* Accessed and dirty bits of FRAME: those of any page mapped to it. */
+static bool
+frame_is_accessed (struct frame *frame) {
+	struct list_elem *e;
+	for (e = list_begin(&frame->pages); e != list_end(&frame->pages); e = list_next(e))
+		if (page_is_accessed(list_entry(e, struct page, share_elem)))
+			return true;
+	return false;
+}
+
+static void
+frame_clear_accessed (struct frame *frame) {
+	struct list_elem *e;
+	for (e = list_begin(&frame->pages); e != list_end(&frame->pages); e = list_next(e))
+		page_clear_accessed(list_entry(e, struct page, share_elem));
+}
+
+static bool
+frame_is_dirty (struct frame *frame) {
+	struct list_elem *e;
+	for (e = list_begin(&frame->pages); e != list_end(&frame->pages); e = list_next(e))
+		if (page_is_dirty(list_entry(e, struct page, share_elem)))
+			return true;
+	return false;
+}
+
+/* Returns true if FRAME may be evicted: it is neither pinned nor under
+ * I/O. With FS, the caller holds file system locks, and a frame that
+ * evicting may write back to a file is left alone too, as the write
+ * would take the file's lock. */
+static bool
+frame_evictable (struct frame *frame, bool fs) {
+	struct list_elem *e;
+
+	if (frame->pin_cnt > 0 || frame->io)
+		return false;
+	if (fs)
+		for (e = list_begin(&frame->pages); e != list_end(&frame->pages); e = list_next(e)) {
+			struct page *page = list_entry(e, struct page, share_elem);
+			if (page_get_type(page) == VM_FILE && page->writable)
+				return false;
+		}
+	return true;
+}
+
+/* Unpins FRAME. A thread waiting in vm_get_frame() may evict it now. */
+static void
+frame_unpin (struct frame *frame) {
+	ASSERT(frame->pin_cnt > 0);
+	if (--frame->pin_cnt == 0)
+		cond_broadcast(&frame_cond, &frame_lock);
+}
+
+/* Drops FRAME, which no page is mapped to, from the frame table and
+ * returns it to the user pool. */
+static void
+frame_release (struct frame *frame) {
+	ASSERT(list_empty(&frame->pages));
+	if (frame->inode != NULL)
+		text_cache_remove(frame);
+	frame_table_remove(frame);
+	frame_cnt--;
+	palloc_free_page(frame->kva);
+	free(frame);
+	cond_broadcast(&frame_cond, &frame_lock);
+}
+
+/* Maps PAGE to FRAME, which may already hold other pages. */
+static void
+frame_attach (struct frame *frame, struct page *page) {
+	list_push_back(&frame->pages, &page->share_elem);
+	frame->page = list_entry(list_front(&frame->pages), struct page, share_elem);
+	page->frame = frame;
+}
+
+/* Unlinks PAGE from its frame. Returns true if no page is left mapped to
+ * the frame. */
+static bool
+frame_detach (struct page *page) {
+	struct frame *frame = page->frame;
+	list_remove(&page->share_elem);
+	page->frame = NULL;
+	if (list_empty(&frame->pages)) {
+		frame->page = NULL;
+		return true;
+	}
+	frame->page = list_entry(list_front(&frame->pages), struct page, share_elem);
+	return false;
+}
+
+/* Unmaps PAGE from its frame, if any. The frame is dropped from the frame
+ * table and returned to the user pool once no other page shares it.
+ * The mapping is cleared first so that pml4_destroy() does not free a
+ * frame still in use by another process, or the zero page. */
+static void
+vm_free_frame (struct page *page) {
+	lock_acquire(&frame_lock);
+	vm_free_frame_locked(page);
+	frame_unlock();
+}
+
+/* Same as vm_free_frame(), with frame_lock held. */
+static void
+vm_free_frame_locked (struct page *page) {
+	vm_wait_io(page);
+	struct frame *frame = page->frame;
+	if (page->owner->pml4 != NULL)
+		pml4_clear_page(page->owner->pml4, page->va);
+	if (frame != NULL) {
+		page->readahead = false;
+		/* A cached frame is kept for the next user. */
+		if (frame_detach(page) && frame->inode == NULL)
+			frame_release(frame);
+	}
+}
+
+/* Picks a victim with the enhanced second chance algorithm, among the
+ * frames that are frame_evictable() with FS. A frame shared by several
+ * pages counts as accessed or dirty if any of them is.
+ * The first and third laps only take a frame that is neither accessed
+ * nor dirty; the second and fourth also take dirty ones and clear the
+ * accessed bit of every frame they pass. Four laps find one unless
+ * every frame is pinned or under I/O; then returns NULL. */
+static struct frame *
+vm_get_victim_clock (bool fs) {
+	size_t frame_cnt = list_size(&frame_table);
+	for (size_t lap = 0; lap < 4; lap++) {
+		bool take_dirty = lap % 2 == 1;
+		for (size_t i = 0; i < frame_cnt; i++) {
+			struct frame *frame = clock_advance();
+			if (frame->page == NULL)
+				return frame;  /* Cached, but mapped by no one. */
+			if (!frame_evictable(frame, fs))
+				continue;
+			if (frame_is_accessed(frame)) {
+				if (take_dirty)
+					frame_clear_accessed(frame);
+				continue;
+			}
+			if (take_dirty || !frame_is_dirty(frame))
+				return frame;
+		}
+	}
+	return NULL;
+}
+
+/* Get the struct frame, that will be evicted, off the frame table.
+ * Returns NULL if no frame can be evicted. FS is as for
+ * frame_evictable(). */
+static struct frame *
+vm_get_victim (bool fs) {
 	struct frame *victim = NULL;
 	/* TODO: The policy for eviction is up to you. */
-	struct list_elem* e = list_pop_front(&frame_table);
-	victim = list_entry(e, struct frame, frame_elem);
+	if (list_empty(&frame_table))
+		return NULL;
+	if (vm_evict_policy == VM_EVICT_CLOCK)
+		victim = vm_get_victim_clock(fs);
+	else {
+		struct list_elem *e = list_begin(&frame_table);
+		while (e != list_end(&frame_table)) {
+			victim = list_entry(e, struct frame, frame_elem);
+			if (frame_evictable(victim, fs))
+				break;
+			e = list_next(e);
+		}
+		if (e == list_end(&frame_table))
+			victim = NULL;
+	}
+	if (victim == NULL)
+		return NULL;
+	frame_table_remove(victim);
+	if (victim->inode != NULL)
+		text_cache_remove(victim);
 	return victim;
 }
 
+/* Writes out every page of the CNT frames in VICTIMS, which are off the
+ * frame table, and unlinks them from the frames. A frame shared
+ * copy-on-write gives each of its pages its own copy in swap. frame_lock
+ * is released during the writes: the pages are unmapped and the frames
+ * marked as under I/O first, so that an access faults and waits in
+ * vm_wait_io(). Anonymous pages are swapped out together so that they
+ * take one disk request and adjacent swap slots.
+ * Must be called with frame_lock held. */
+static void
+vm_evict_pages (struct frame *victims[], size_t cnt) {
+	struct page *anon[SWAP_CLUSTER_MAX];
+	size_t anon_cnt = 0, i;
+	struct list_elem *e;
+
+	for (i = 0; i < cnt; i++) {
+		struct list *pages = &victims[i]->pages;
+		victims[i]->io = true;
+		for (e = list_begin(pages); e != list_end(pages); e = list_next(e)) {
+			struct page *page = list_entry(e, struct page, share_elem);
+			page->readahead = false;
+			if (page->owner != NULL)
+				pml4_clear_page(page->owner->pml4, page->va);
+		}
+	}
+	/* Nobody links pages to or unlinks them from a frame under I/O, so
+	 * the lists hold still. An unmapped text cache frame has nothing to
+	 * save. */
+	lock_release(&frame_lock);
+	for (i = 0; i < cnt; i++) {
+		struct list *pages = &victims[i]->pages;
+		for (e = list_begin(pages); e != list_end(pages); e = list_next(e)) {
+			struct page *page = list_entry(e, struct page, share_elem);
+			if (page_get_type(page) == VM_ANON && anon_cnt < SWAP_CLUSTER_MAX)
+				anon[anon_cnt++] = page;
+			else
+				swap_out(page);
+		}
+	}
+	if (anon_cnt > 0)
+		anon_swap_out_cluster(anon, anon_cnt);
+	lock_acquire(&frame_lock);
+	for (i = 0; i < cnt; i++) {
+		while (victims[i]->page != NULL)
+			frame_detach(victims[i]->page);
+		victims[i]->io = false;
+	}
+	cond_broadcast(&frame_cond, &frame_lock);
+}
+
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * Return NULL if no frame is frame_evictable() with FS.
+ * Must be called with frame_lock held; it is released during the
+ * write. */
 static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
+vm_evict_frame (bool fs) {
+	struct frame *victim UNUSED = vm_get_victim (fs);
 	/* TODO: swap out the victim and return the evicted frame. */
-	if (victim == NULL){
-		ASSERT(0);
+	if (victim == NULL)
+		return NULL;
+	vm_evict_pages(&victim, 1);
+	evict_cnt++;
+	return victim;
+}
+
+/* Evicts up to CNT frames, at most SWAP_CLUSTER_MAX, and returns them to
+ * the user pool. Returns the number evicted, which is 0 if every frame
+ * is pinned or under I/O.
+ * Must be called with frame_lock held; it is released during the
+ * writes. */
+static size_t
+vm_evict_cluster (size_t cnt) {
+	struct frame *victims[SWAP_CLUSTER_MAX];
+	struct frame *victim;
+	size_t victim_cnt = 0;
+
+	if (cnt > SWAP_CLUSTER_MAX)
+		cnt = SWAP_CLUSTER_MAX;
+	while (victim_cnt < cnt && (victim = vm_get_victim(false)) != NULL)
+		victims[victim_cnt++] = victim;
+	if (victim_cnt == 0)
+		return 0;
+	vm_evict_pages(victims, victim_cnt);
+	for (size_t i = 0; i < victim_cnt; i++) {
+		palloc_free_page(victims[i]->kva);
+		free(victims[i]);
 	}
-	if (victim->page == NULL){
-		ASSERT(0);
+	frame_cnt -= victim_cnt;
+	evict_cnt += victim_cnt;
+	swapd_reclaim_cnt += victim_cnt;
+	cond_broadcast(&frame_cond, &frame_lock);
+	return victim_cnt;
+}
+
+/* Writes back up to SWAPD_CLEAN_BATCH dirty file-backed pages ahead of
+ * the clock hand, so that they can later be evicted without a write.
+ * The pages stay mapped; their frames are marked as under I/O while
+ * frame_lock is released for the writes.
+ * Must be called with frame_lock held. */
+static void
+vm_swapd_clean (void) {
+	struct frame *dirty[SWAPD_CLEAN_BATCH];
+	size_t dirty_cnt = 0;
+	struct list_elem *e = clock_hand;
+	for (int i = 0; i < SWAPD_CLEAN_BATCH && !list_empty(&frame_table); i++) {
+		if (e == list_end(&frame_table))
+			e = list_begin(&frame_table);
+		struct frame *frame = list_entry(e, struct frame, frame_elem);
+		e = list_next(e);
+		struct page *page = frame->page;
+		if (page == NULL || frame->pin_cnt > 0 || frame->io
+				|| frame_is_shared(frame) || page_get_type(page) != VM_FILE)
+			continue;
+		uint64_t *pml4 = page->owner->pml4;
+		if (pml4_is_dirty(pml4, page->va) && !pml4_is_accessed(pml4, page->va)) {
+			frame->io = true;
+			dirty[dirty_cnt++] = frame;
+		}
 	}
-	while (!is_user_vaddr(victim->page->va)){
-		victim = vm_get_victim();
+	if (dirty_cnt == 0)
+		return;
+	lock_release(&frame_lock);
+	for (size_t i = 0; i < dirty_cnt; i++)
+		swap_out(dirty[i]->page);  /* Writes back and clears the dirty bit. */
+	lock_acquire(&frame_lock);
+	for (size_t i = 0; i < dirty_cnt; i++)
+		dirty[i]->io = false;
+	swapd_clean_cnt += dirty_cnt;
+	cond_broadcast(&frame_cond, &frame_lock);
+}
+
+/* Page-out daemon: keeps between swapd_low and swapd_high user frames
+ * free by evicting cold pages in the background. */
+static void
+vm_swapd (void *aux UNUSED) {
+	for (;;) {
+		sema_down(&swapd_sema);
+		lock_acquire(&frame_lock);
+		vm_swapd_clean();
+		while (vm_free_frame_cnt() < swapd_high)
+			if (vm_evict_cluster(swapd_high - vm_free_frame_cnt()) == 0)
+				break;  /* All pinned or under I/O: wait to be woken. */
+		frame_unlock();
 	}
-	swap_out(victim->page);
-	return victim;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * space, or waits until a frame can be evicted if all are pinned or under
+ * I/O. FS is true if the caller holds file system locks; see
+ * frame_evictable().
+ * Wakes up the page-out daemon when free frames run low.
+ * Must be called with frame_lock held; it is released while a page is
+ * evicted, so the caller must not rely on what it saw before. */
 static struct frame *
-vm_get_frame (void) {
+vm_get_frame (bool fs) {
 	struct frame *frame = NULL;
 	/* TODO: Fill this function. */
-	frame = malloc(sizeof(struct frame));
-	frame->kva = palloc_get_page(PAL_USER);
-	if (frame->kva==NULL) {
+	for (;;) {
+		frame = malloc(sizeof(struct frame));
+		frame->kva = palloc_get_page(PAL_USER);
+		if (frame->kva != NULL) {
+			list_init(&frame->pages);
+			frame->inode = NULL;
+			frame_cnt++;
+			break;
+		}
 		free(frame);
-		frame = vm_evict_frame();
-		frame->page->frame == NULL;
-		pml4_clear_page(thread_current()->pml4, frame->page->va);
+		frame = vm_evict_frame(fs);
+		if (frame != NULL) {
+			direct_reclaim_cnt++;
+			break;
+		}
+		sema_up(&swapd_sema);
+		cond_wait(&frame_cond, &frame_lock);
 	}
+	if (vm_free_frame_cnt() < swapd_low)
+		sema_up(&swapd_sema);
 	frame->page = NULL;
+	frame->pin_cnt = 0;
+	frame->io = false;
 	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
 	list_push_back(&frame_table, &frame->frame_elem);
 	return frame;
 }
 
+/* Returns a new frame if one is free without eviction and free frames
+ * are not running low, or NULL. For speculative loads.
+ * Must be called with frame_lock held. */
+static struct frame *
+vm_get_free_frame (void) {
+	if (vm_free_frame_cnt() <= swapd_low)
+		return NULL;
+	struct frame *frame = malloc(sizeof(struct frame));
+	if (frame == NULL)
+		return NULL;
+	frame->kva = palloc_get_page(PAL_USER);
+	if (frame->kva == NULL) {
+		free(frame);
+		return NULL;
+	}
+	list_init(&frame->pages);
+	frame->page = NULL;
+	frame->pin_cnt = 0;
+	frame->io = false;
+	frame->inode = NULL;
+	list_push_back(&frame_table, &frame->frame_elem);
+	frame_cnt++;
+	return frame;
+}
+
+/* Returns true if an access to ADDR, with the user stack pointer at
+ * RSP, is one that grows the stack. */
+static bool
+vm_is_stack_access (void *addr, void *rsp) {
+	return (uint64_t)addr > USER_STACK - (1<<20) && USER_STACK > (uint64_t)addr
+		&& (uint64_t)addr > (uint64_t)rsp - 32;
+}
+
 /* Growing the stack. */
 static void
 vm_stack_growth (void *addr UNUSED) {
@@ -180,13 +723,90 @@ vm_stack_growth (void *addr UNUSED) {
 /* Handle the fault on write_protected page */
 static bool
 vm_handle_wp (struct page *page UNUSED) {
+	uint64_t *pml4 = page->owner->pml4;
+	bool success = true;
+
+	lock_acquire(&frame_lock);
+	vm_wait_io(page);
+	struct frame *frame = page->frame;
+	if (frame == NULL) {
+		/* Mapped to the zero page, or evicted by the page-out daemon
+		 * since the fault. */
+		pml4_clear_page(pml4, page->va);
+		lock_release(&frame_lock);
+		return vm_do_claim_page(page);
+	}
+	if (!frame_is_shared(frame)) {
+		/* Last one holding the frame: take it over. */
+		pml4_set_writable(pml4, page->va, true);
+	} else {
+		/* Copy the shared frame on the first write. FRAME is pinned so
+		 * that it is not evicted while we get a new one. */
+		frame->pin_cnt++;
+		struct frame *copy = vm_get_frame(false);
+		frame_unpin(frame);
+		memcpy(copy->kva, frame->kva, PGSIZE);
+		/* The other sharers may have gone while a page was evicted. */
+		if (frame_detach(page) && frame->inode == NULL)
+			frame_release(frame);
+		frame_attach(copy, page);
+		/* Flush the stale translation: the kernel writes here without
+		 * faulting first when it is called from vm_break_cow(). */
+		pml4_clear_page(pml4, page->va);
+		success = pml4_set_page(pml4, page->va, copy->kva, true);
+	}
+	frame_unlock();
+	return success;
 }
 
-/* Return true on success */
+/* Gives PAGE a private frame if it shares one copy-on-write or is mapped
+ * to the zero page.
+ * The kernel runs without CR0.WP, so its writes to user memory do not
+ * fault on read-only mappings; call this before writing to a user page
+ * on behalf of a process. Returns true on success. */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
+vm_break_cow (struct page *page) {
+	if (page->frame == NULL) {
+		if (pml4_get_page(page->owner->pml4, page->va) != zero_kva)
+			return true;
+	} else if (!frame_is_shared(page->frame))
+		return true;
+	return vm_handle_wp (page);
+}
+
+/* Maps the zero page, read-only, for a read fault on PAGE if PAGE is an
+ * anonymous page known to hold only zeros: a page with nothing to load
+ * yet, or one swapped out as zeros. The first write then faults and gets
+ * a private frame through vm_handle_wp(). Returns true if mapped. */
+static bool
+vm_map_zero_page (struct page *page) {
+	bool success = false;
+
+	lock_acquire(&frame_lock);
+	vm_wait_io(page);
+	if (page->frame != NULL)
+		goto done;
+	if (VM_TYPE(page->operations->type) == VM_UNINIT) {
+		if (VM_TYPE(page->uninit.type) != VM_ANON || page->uninit.init != NULL)
+			goto done;
+		/* The anonymous initializer does not touch the frame. */
+		if (!swap_in(page, zero_kva))
+			goto done;
+		page->anon.swapped_out = true;
+		page->anon.zero = true;
+	} else if (VM_TYPE(page->operations->type) != VM_ANON || !page->anon.zero)
+		goto done;
+	success = pml4_set_page(page->owner->pml4, page->va, zero_kva, false);
+done:
+	lock_release(&frame_lock);
+	return success;
+}
+
+/* Handles a fault for vm_try_handle_fault(). */
+static bool
+vm_handle_fault (struct intr_frame *f, void *addr, bool user, bool write,
+		bool not_present) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
 	struct page *page = NULL;
 	/* TODO: Validate the fault */
 	/* TODO: Your code goes here */
@@ -197,7 +817,7 @@ vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
 	page = spt_find_page(spt, addr);
 	if (page == NULL){
 		void *rsp = user ? f->rsp : thread_current()->rsp;
-		if((uint64_t)addr > USER_STACK - (1<<20) && USER_STACK > (uint64_t)addr && (uint64_t)addr > (uint64_t)rsp - 32){
+		if(vm_is_stack_access(addr, rsp)){
 			vm_stack_growth (addr);
 			page = spt_find_page(spt, addr);
 		}
@@ -211,9 +831,27 @@ vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
 	}
 
 	ASSERT(page != NULL);
+	/* Write to a present page: it is mapped read-only copy-on-write or
+	 * to the zero page. */
+	if (!not_present)
+		return vm_handle_wp (page);
+	if (!write && vm_map_zero_page (page))
+		return true;
 	return vm_do_claim_page (page);
 }
 
+/* Return true on success */
+bool
+vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
+		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
+	int64_t start = timer_ticks ();
+	bool success = vm_handle_fault (f, addr, user, write, not_present);
+
+	fault_ticks += timer_elapsed (start);
+	fault_cnt++;
+	return success;
+}
+
 /* Free the page.
  * DO NOT MODIFY THIS FUNCTION. */
 void
@@ -231,21 +869,500 @@ vm_claim_page (void *va UNUSED) {
 	return vm_do_claim_page (page);
 }
 
+/* Returns how many pages to swap in for a fault on swap slot SLOT.
+ * The window is about twice the number of read-around pages used since
+ * the last read-around, but never less than half the previous window so
+ * that one miss does not cancel a sequential run. Without hits, pages are
+ * read around only for a fault right after the previous slot. */
+static size_t
+vm_swap_ra_window (size_t slot) {
+	size_t win = 1;
+
+	while (win < swap_ra_hits + 2)
+		win *= 2;
+	if (win == 2 && slot != swap_ra_prev_slot + 1)
+		win = 1;
+	if (win < swap_ra_prev_win / 2)
+		win = swap_ra_prev_win / 2;
+	if (win > vm_swap_ra_max)
+		win = vm_swap_ra_max;
+	if (win > SWAP_CLUSTER_MAX)
+		win = SWAP_CLUSTER_MAX;
+	if (win == 0)
+		win = 1;
+	swap_ra_hits = 0;
+	swap_ra_prev_win = win;
+	swap_ra_prev_slot = slot;
+	return win;
+}
+
+/* Swaps in the anonymous page PAGE, which already has a pinned frame,
+ * together with the pages that follow it both in the address space and
+ * on the swap disk, in one disk request. Pages are read around only into
+ * free frames; no frame is evicted for them.
+ * Must be called with frame_lock held; it is released during the read. */
+static bool
+vm_swap_in_around (struct page *page) {
+	struct page *pages[SWAP_CLUSTER_MAX];
+	void *kvas[SWAP_CLUSTER_MAX];
+	size_t slot = page->anon.swap_idx;
+	size_t win = vm_swap_ra_window(slot);
+	size_t cnt = 1;
+
+	pages[0] = page;
+	kvas[0] = page->frame->kva;
+	for (; cnt < win; cnt++) {
+		void *va = page->va + cnt * PGSIZE;
+		if (!is_user_vaddr(va))
+			break;
+		struct page *next = spt_find_page(&page->owner->spt, va);
+		if (next == NULL || next->frame != NULL
+				|| VM_TYPE(next->operations->type) != VM_ANON
+				|| !anon_in_swap_slot(next) || next->anon.swap_idx != slot + cnt)
+			break;
+		struct frame *frame = vm_get_free_frame();
+		if (frame == NULL)
+			break;
+		frame_attach(frame, next);
+		frame->pin_cnt++;
+		next->readahead = true;
+		pages[cnt] = next;
+		kvas[cnt] = frame->kva;
+	}
+	swap_ra_cnt += cnt - 1;
+	lock_release(&frame_lock);
+	bool success = anon_swap_in_cluster(pages, kvas, cnt);
+	lock_acquire(&frame_lock);
+	for (size_t i = 1; i < cnt; i++)
+		frame_unpin(pages[i]->frame);
+	return success;
+}
+
+static uint64_t
+text_cache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct frame *frame = hash_entry(e, struct frame, cache_elem);
+	return hash_bytes(&frame->inode, sizeof frame->inode) ^ hash_int(frame->ofs);
+}
+
+static bool
+text_cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct frame *a = hash_entry(a_, struct frame, cache_elem);
+	const struct frame *b = hash_entry(b_, struct frame, cache_elem);
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->ofs < b->ofs;
+}
+
+/* Sets *INODE, *OFS and *SIZE to where PAGE's data comes from and
+ * returns true if PAGE may be shared through the text cache: a
+ * read-only file-backed page. */
+static bool
+text_cache_key (struct page *page, struct inode **inode, off_t *ofs,
+		size_t *size) {
+	if (page->writable)
+		return false;
+	if (VM_TYPE(page->operations->type) == VM_UNINIT) {
+		struct aux *aux = page->uninit.aux;
+		if (page->uninit.type != (VM_FILE | VM_FROM_FILE))
+			return false;
+		*inode = file_get_inode(aux->file);
+		*ofs = aux->ofs;
+		*size = aux->page_read_bytes;
+	} else if (VM_TYPE(page->operations->type) == VM_FILE) {
+		*inode = file_get_inode(page->file.fp);
+		*ofs = page->file.ofs;
+		*size = page->file.size;
+	} else
+		return false;
+	return true;
+}
+
+/* Returns the cached frame holding SIZE bytes of INODE at OFS, or NULL.
+ * Drops the entry if INODE has been written since. */
+static struct frame *
+text_cache_find (struct inode *inode, off_t ofs, size_t size) {
+	struct frame key;
+	struct hash_elem *e;
+
+	key.inode = inode;
+	key.ofs = ofs;
+	e = hash_find(&text_cache, &key.cache_elem);
+	if (e == NULL)
+		return NULL;
+	struct frame *frame = hash_entry(e, struct frame, cache_elem);
+	if (frame->write_cnt == inode->write_cnt && frame->size == size)
+		return frame;
+	if (list_empty(&frame->pages))
+		frame_release(frame);
+	else
+		text_cache_remove(frame);
+	return NULL;
+}
+
+/* Enters the frame of PAGE, just loaded, into the text cache if PAGE is
+ * cacheable and its data is not cached yet. The record that closes the
+ * inode on removal is allocated here, so that removal cannot fail; the
+ * frame is not cached without memory for it. */
+static void
+text_cache_add (struct page *page) {
+	struct frame *frame = page->frame;
+	struct inode *inode;
+	off_t ofs;
+	size_t size;
+
+	if (frame->inode != NULL || !text_cache_key(page, &inode, &ofs, &size)
+			|| text_cache_find(inode, ofs, size) != NULL)
+		return;
+	frame->orphan = malloc(sizeof *frame->orphan);
+	if (frame->orphan == NULL)
+		return;
+	frame->inode = inode_reopen(inode);
+	frame->ofs = ofs;
+	frame->size = size;
+	frame->write_cnt = inode->write_cnt;
+	hash_insert(&text_cache, &frame->cache_elem);
+	text_cache_miss_cnt++;
+}
+
+/* Removes FRAME from the text cache. Its inode is closed by
+ * frame_unlock(), as the last close may write the file back. */
+static void
+text_cache_remove (struct frame *frame) {
+	hash_delete(&text_cache, &frame->cache_elem);
+	frame->orphan->inode = frame->inode;
+	list_push_back(&text_cache_orphans, &frame->orphan->elem);
+	frame->orphan = NULL;
+	frame->inode = NULL;
+}
+
+/* Maps PAGE, read-only, to the frame in the text cache that holds its
+ * data, if any. Returns true if it did.
+ * Must be called with frame_lock held. */
+static bool
+text_cache_claim (struct page *page) {
+	struct inode *inode;
+	off_t ofs;
+	size_t size;
+	struct frame *frame;
+
+	if (!text_cache_key(page, &inode, &ofs, &size)
+			|| (frame = text_cache_find(inode, ofs, size)) == NULL)
+		return false;
+	if (VM_TYPE(page->operations->type) == VM_UNINIT
+			&& !page->uninit.page_initializer(page, page->uninit.type, frame->kva))
+		return false;
+	frame_attach(frame, page);
+	text_cache_hit_cnt++;
+	return pml4_set_page(page->owner->pml4, page->va, frame->kva, false);
+}
+
+/* Returns how many pages to map for a fault on the page at VA loaded
+ * from a file, and adapts the current process's window. */
+static size_t
+vm_fault_around_window (void *va) {
+	struct thread *t = thread_current();
+	size_t win = t->fault_around_win ? t->fault_around_win : FAULT_AROUND_INIT;
+
+	if (va == t->fault_around_next)
+		win *= 2;
+	else if (t->fault_around_win != 0)
+		win /= 2;
+	if (win > vm_fault_around_max)
+		win = vm_fault_around_max;
+	if (win > FAULT_AROUND_MAX)
+		win = FAULT_AROUND_MAX;
+	if (win == 0)
+		win = 1;
+	t->fault_around_win = win;
+	return win;
+}
+
+/* Returns true if NEXT can be loaded together with PAGE, CNT pages
+ * before it: an uninit page of the same kind, not yet loaded, whose
+ * contents follow PAGE's in the same file. */
+static bool
+vm_fault_around_match (struct page *page, struct page *next, size_t cnt) {
+	struct aux *aux = page->uninit.aux;
+	struct aux *next_aux;
+
+	if (next == NULL || next->frame != NULL
+			|| VM_TYPE(next->operations->type) != VM_UNINIT
+			|| next->uninit.type != page->uninit.type
+			|| next->uninit.init != page->uninit.init
+			|| next->writable != page->writable)
+		return false;
+	next_aux = next->uninit.aux;
+	return file_get_inode(next_aux->file) == file_get_inode(aux->file)
+		&& next_aux->ofs == aux->ofs + (off_t) (cnt * PGSIZE);
+}
+
+/* Loads PAGE, an uninit page of the current process that is loaded from
+ * a file and already mapped to its pinned frame, together with the
+ * following pages that vm_fault_around_match(), reading contiguous data
+ * into each frame. Pages are only mapped around into free frames; no
+ * frame is evicted for them. Like lazy_load_segment(), fails on a short
+ * read of code or data, but not of an mmap()ed file, whose tail past
+ * the end of file reads as zeros.
+ * Must be called with frame_lock held; it is released during the read. */
+static bool
+vm_fault_around (struct page *page) {
+	struct page *pages[FAULT_AROUND_MAX];
+	struct aux *aux = page->uninit.aux;
+	size_t win = vm_fault_around_window(page->va);
+	size_t cnt = 1;
+	off_t size = aux->page_read_bytes;
+
+	ASSERT(page->owner == thread_current());
+	pages[0] = page;
+	for (; cnt < win && size == (off_t) (cnt * PGSIZE); cnt++) {
+		void *va = page->va + cnt * PGSIZE;
+		if (!is_user_vaddr(va))
+			break;
+		struct page *next = spt_find_page(&page->owner->spt, va);
+		if (!vm_fault_around_match(page, next, cnt))
+			break;
+		struct inode *inode;
+		off_t ofs;
+		size_t size;
+		if (text_cache_key(next, &inode, &ofs, &size)
+				&& text_cache_find(inode, ofs, size) != NULL)
+			break;  /* Leave it to the text cache. */
+		struct frame *frame = vm_get_free_frame();
+		if (frame == NULL)
+			break;
+		frame_attach(frame, next);
+		if (!pml4_set_page(page->owner->pml4, va, frame->kva, next->writable)) {
+			vm_free_frame_locked(next);
+			break;
+		}
+		frame->pin_cnt++;
+		pages[cnt] = next;
+		size += ((struct aux *) next->uninit.aux)->page_read_bytes;
+	}
+
+	/* The frames are pinned. Read through their kernel addresses, not
+	 * the user ones: text is mapped read-only. */
+	bool short_read = false;
+	lock_release(&frame_lock);
+	for (size_t i = 0; i < cnt; i++) {
+		struct aux *p_aux = pages[i]->uninit.aux;
+		void *kva = pages[i]->frame->kva;
+		off_t read = file_read_at(aux->file, kva, p_aux->page_read_bytes,
+				p_aux->ofs);
+		if (read < (off_t) p_aux->page_read_bytes) {
+			memset(kva + read, 0, p_aux->page_read_bytes - read);
+			short_read = true;
+		}
+	}
+	lock_acquire(&frame_lock);
+	for (size_t i = 1; i < cnt; i++)
+		frame_unpin(pages[i]->frame);
+	if (short_read && aux->map_addr == NULL)
+		return false;
+	for (size_t i = 0; i < cnt; i++) {
+		struct page *p = pages[i];
+		struct uninit_page *uninit = &p->uninit;
+		struct aux *p_aux = uninit->aux;
+		memset(p->frame->kva + p_aux->page_read_bytes, 0, p_aux->page_zero_bytes);
+		if (!uninit->page_initializer(p, uninit->type, p->frame->kva))
+			return false;
+		/* Loading is not a write, and pages mapped around have not been
+		 * used yet. */
+		pml4_set_dirty(p->owner->pml4, p->va, false);
+		if (i > 0)
+			pml4_set_accessed(p->owner->pml4, p->va, false);
+		text_cache_add(p);
+	}
+	fault_around_cnt += cnt - 1;
+	thread_current()->fault_around_next = page->va + cnt * PGSIZE;
+	return true;
+}
+
+/* Maps PAGE, which was read around, on its first access.
+ * Must be called with frame_lock held. */
+static bool
+vm_swap_ra_map (struct page *page) {
+	page->readahead = false;
+	swap_ra_hits++;
+	swap_ra_hit_cnt++;
+	return pml4_set_page(page->owner->pml4, page->va, page->frame->kva,
+			page->writable && !frame_is_shared(page->frame));
+}
+
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	/* The frame is pinned until the contents are in, so that the
+	 * page-out daemon cannot evict a half loaded frame. frame_lock is
+	 * not held while they are read. */
+	lock_acquire(&frame_lock);
+	vm_wait_io(page);
+	if (page->frame != NULL) {
+		/* Claimed by someone else while we waited for the lock, or read
+		 * around and waiting for its first access. */
+		bool success = !page->readahead || vm_swap_ra_map(page);
+		frame_unlock();
+		return success;
+	}
+	if (text_cache_claim(page)) {
+		frame_unlock();
+		return true;
+	}
+	struct frame *frame = vm_get_frame (false);
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	frame_attach(frame, page);
 
 	/* TODO: Insert page table entry to map page's VA to frame's PA. */
-	if (!pml4_set_page(thread_current()->pml4, page->va, frame->kva, page->writable)) {
-		return false;
+	bool success = pml4_set_page(thread_current()->pml4, page->va, frame->kva, page->writable);
+	frame->pin_cnt++;
+	if (success) {
+		if (VM_TYPE(page->operations->type) == VM_ANON && anon_in_swap_slot(page))
+			success = vm_swap_in_around(page);
+		else if (VM_TYPE(page->operations->type) == VM_UNINIT
+				&& (page->uninit.type & VM_FROM_FILE) && page->owner == thread_current())
+			success = vm_fault_around(page);
+		else {
+			lock_release(&frame_lock);
+			success = swap_in (page, frame->kva);
+			lock_acquire(&frame_lock);
+			if (success)
+				text_cache_add(page);
+		}
 	}
-	bool b = true;
+	frame_unpin(frame);
+	frame_unlock();
+	return success;
+}
+
+/* Kernel pages. A page that is in no supplemental page table, such as a
+ * page of the page cache, gets its frame from the frame table like a
+ * user page, and is evicted through its swap_out() operation, but only
+ * while it is not pinned. */
+
+/* Makes sure PAGE has a frame, swapping it in if needed, and pins the
+ * frame until vm_page_unpin(). The swap_in() operation of such a page
+ * must not do I/O, as it runs with frame_lock held. */
+void
+vm_page_pin (struct page *page) {
+	lock_acquire(&frame_lock);
+	for (;;) {
+		vm_wait_io(page);
+		if (page->frame != NULL)
+			break;
+		struct frame *frame = vm_get_frame(true);
+		if (page->frame != NULL) {
+			/* Pinned by someone else while a page was evicted. */
+			frame_release(frame);
+			continue;
+		}
+		frame_attach(frame, page);
+		swap_in(page, frame->kva);
+	}
+	page->frame->pin_cnt++;
+	lock_release(&frame_lock);
+}
+
+/* Unpins the frame of PAGE. */
+void
+vm_page_unpin (struct page *page) {
+	lock_acquire(&frame_lock);
+	ASSERT(page->frame != NULL);
+	frame_unpin(page->frame);
+	lock_release(&frame_lock);
+}
+
+/* Pins the frame of PAGE until vm_page_unpin() and returns true if PAGE
+ * has one, or returns false. */
+bool
+vm_page_pin_resident (struct page *page) {
+	lock_acquire(&frame_lock);
+	vm_wait_io(page);
+	bool resident = page->frame != NULL;
+	if (resident)
+		page->frame->pin_cnt++;
+	lock_release(&frame_lock);
+	return resident;
+}
+
+/* Makes the page at user address VA of the running process present, and
+ * private to it if WRITE, growing the stack like a fault would, and pins
+ * its frame until vm_page_unpin(). Returns the page, or NULL if VA may
+ * not be accessed that way.
+ * The kernel copies to and from a pinned page without faulting, as it
+ * must while it holds a file's lock: the fault may need to read a file,
+ * or wait for one to be written back. */
+struct page *
+vm_pin_user (void *va, bool write) {
+	struct thread *t = thread_current();
+	struct page *page;
+
+	if (!is_user_vaddr(va))
+		return NULL;
+	page = spt_find_page(&t->spt, va);
+	if (page == NULL && vm_is_stack_access(va, t->rsp)) {
+		vm_stack_growth(va);
+		page = spt_find_page(&t->spt, va);
+	}
+	if (page == NULL || (write && !page->writable))
+		return NULL;
+	for (;;) {
+		lock_acquire(&frame_lock);
+		vm_wait_io(page);
+		struct frame *frame = page->frame;
+		if (frame != NULL && !page->readahead
+				&& (!write || !frame_is_shared(frame))) {
+			frame->pin_cnt++;
+			lock_release(&frame_lock);
+			return page;
+		}
+		/* Shared copy-on-write or mapped to the zero page, else not
+		 * mapped at all. */
+		bool wp = frame != NULL ? !page->readahead
+			: pml4_get_page(t->pml4, page->va) != NULL;
+		lock_release(&frame_lock);
+		if (!(wp ? vm_handle_wp(page) : vm_do_claim_page(page)))
+			return NULL;
+	}
+}
+
+/* Writes PAGE back, through its swap_out() operation, if it has a frame.
+ * The frame stays, pinned during the write. */
+void
+vm_page_sync (struct page *page) {
+	lock_acquire(&frame_lock);
+	vm_wait_io(page);
+	struct frame *frame = page->frame;
+	if (frame != NULL) {
+		frame->pin_cnt++;
+		lock_release(&frame_lock);
+		swap_out(page);
+		lock_acquire(&frame_lock);
+		frame_unpin(frame);
+	}
+	lock_release(&frame_lock);
+}
 
-	return swap_in (page, frame->kva);
+/* Returns the frame of PAGE, which must not be pinned, to the user pool,
+ * writing PAGE back first if SYNC. */
+void
+vm_page_drop (struct page *page, bool sync) {
+	lock_acquire(&frame_lock);
+	vm_wait_io(page);
+	struct frame *frame = page->frame;
+	if (frame != NULL) {
+		ASSERT(frame->pin_cnt == 0);
+		if (sync) {
+			frame->pin_cnt++;
+			lock_release(&frame_lock);
+			swap_out(page);
+			lock_acquire(&frame_lock);
+			frame_unpin(frame);
+		}
+		frame_detach(page);
+		frame_release(frame);
+	}
+	lock_release(&frame_lock);
 }
 
 uint64_t hash_bytes_hash(const struct hash_elem *e, void *aux) {
@@ -260,6 +1377,44 @@ bool hash_bytes_less(const struct hash_elem *a, const struct hash_elem *b, void
 	// return hash_bytes_hash(a, NULL) < hash_bytes_hash(b, NULL);
 }
 
+/* Makes the resident page SRC of the parent copy-on-write: a new page of
+ * the current process shares SRC's frame and both are mapped read-only,
+ * so that the first write in either process gets a private copy through
+ * vm_handle_wp().
+ * Sets *RESIDENT to false and does nothing if SRC has no frame. */
+static bool
+spt_share_page (struct supplemental_page_table *dst, struct page *src,
+		bool *resident) {
+	bool success = false;
+
+	lock_acquire(&frame_lock);
+	vm_wait_io(src);
+	*resident = src->frame != NULL;
+	if (!*resident) {
+		lock_release(&frame_lock);
+		return false;
+	}
+	if (src->readahead)
+		vm_swap_ra_map(src);
+	struct page *page = malloc(sizeof(struct page));
+	if (page != NULL) {
+		memcpy(page, src, sizeof(struct page));
+		page->owner = thread_current();
+		if (page_get_type(src) == VM_FILE) {
+			page->file.fp = file_reopen(src->file.fp);
+			page->writable = false;
+		}
+		if (spt_insert_page(dst, page)) {
+			frame_attach(src->frame, page);
+			pml4_set_writable(src->owner->pml4, src->va, false);
+			success = pml4_set_page(page->owner->pml4, page->va, page->frame->kva, false);
+		} else
+			free(page);
+	}
+	lock_release(&frame_lock);
+	return success;
+}
+
 /* Initialize new supplemental page table */
 void
 supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
@@ -267,11 +1422,12 @@ supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
 	hash_init(spt->hash_table, hash_bytes_hash, hash_bytes_less, NULL);
 }
 
-/* Copy supplemental page table from src to dst */
-bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+/* Copies the pages of SRC to DST for supplemental_page_table_copy(). */
+static bool
+spt_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
 	struct hash_iterator i;
+	bool resident;
 	hash_first(&i, src->hash_table);
 	while (hash_next(&i)) {
 		struct page* page_src = hash_entry (hash_cur(&i), struct page, hash_elem);
@@ -285,40 +1441,58 @@ supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
 				return false;
 			}
 		} 
-		else{
-			if(page_get_type(page_src)==VM_ANON){
-
-				if (!vm_alloc_page(page_get_type(page_src), page_src->va, page_src->writable)) {
-					return false;
-				}
-				if (!vm_claim_page(page_src->va)) {
-					return false;
-				}
-				struct page* page_dst = spt_find_page(dst, page_src->va);
-				memcpy(page_dst->frame->kva, page_src->frame->kva, PGSIZE);
-
-			} else if(page_get_type(page_src)==VM_FILE){
-				struct aux* aux = malloc(sizeof(struct aux));
-
-				struct file_page *file_page = &page_src->file;
-				aux->file = file_reopen(file_page->fp);
-				aux->page_read_bytes = file_page->size;
-				aux->page_zero_bytes = NULL;
-				aux->ofs = file_page->ofs;
-				vm_alloc_page_with_initializer(VM_FILE, page_src->va, page_src->writable, lazy_load_segment__, aux);
-
-				struct page *page_dst = spt_find_page(dst, page_src->va);
-				vm_do_claim_page(page_dst);
-				
-				page_dst->writable = false;
-			} else {
-				ASSERT(0); // should not reach
+		else if (spt_share_page(dst, page_src, &resident)) {
+			continue;
+		}
+		else if (resident) {
+			return false;
+		}
+		else if (page_get_type(page_src)==VM_ANON && page_src->anon.zero) {
+			/* All zeros: the child starts from a fresh zero page. */
+			if (!vm_alloc_page(VM_ANON, page_src->va, page_src->writable)) {
+				return false;
+			}
+		}
+		else if (page_get_type(page_src)==VM_ANON) {
+			/* Swapped out: give the child its own copy of the slot. */
+			if (!vm_alloc_page_with_initializer(page_get_type(page_src), page_src->va, page_src->writable, anon_copy_swapped, page_src)) {
+				return false;
+			}
+			if (!vm_claim_page(page_src->va)) {
+				return false;
+			}
+		}
+		else if (page_get_type(page_src)==VM_FILE) {
+			struct aux* aux = malloc(sizeof(struct aux));
+
+			struct file_page *file_page = &page_src->file;
+			aux->file = file_reopen(file_page->fp);
+			aux->page_read_bytes = file_page->size;
+			aux->page_zero_bytes = PGSIZE - file_page->size;
+			aux->ofs = file_page->ofs;
+			aux->map_addr = file_page->map_addr;
+			if (!vm_alloc_page_with_initializer(VM_FILE | VM_FROM_FILE, page_src->va, false, lazy_load_segment__, aux)) {
+				return false;
 			}
+		} else {
+			ASSERT(0); // should not reach
 		}
 	}
 	return true;
 }
 
+/* Copy supplemental page table from src to dst */
+bool
+supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
+		struct supplemental_page_table *src UNUSED) {
+	int64_t start = timer_ticks ();
+	bool success = spt_copy (dst, src);
+
+	fork_ticks += timer_elapsed (start);
+	fork_cnt++;
+	return success;
+}
+
 /* Free the resource hold by the supplemental page table */
 void
 supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
@@ -335,6 +1509,7 @@ supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
 		if (page_get_type(p)==VM_FILE) {
 			write_if_dirty(p);
 		}
+		vm_free_frame(p);
 		destroy(hash_entry(hash_cur(&i), struct page, hash_elem));
 	}
 	free(spt->hash_table);
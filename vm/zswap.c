@@ -0,0 +1,333 @@
+/* zswap.c: Compressed cache of swapped out anonymous pages.
+ *
+ * Pages are compressed with a small LZ77 codec in the format of LZ4
+ * blocks and kept in a pool of kernel pages, so that swapping them back
+ * in only costs a decompression. A page goes to the swap disk instead
+ * when it does not compress to 3/4 of its size or the pool is full.
+ *
+ * Each pool page is split into ZSWAP_CHUNK byte chunks, and a compressed
+ * page takes a run of chunks inside a single pool page. */
+
+#include "vm/zswap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+#define ZSWAP_CHUNK 64                       /* Allocation unit in bytes. */
+#define ZSWAP_CHUNK_CNT (PGSIZE / ZSWAP_CHUNK) /* Chunks per pool page. */
+#define ZSWAP_MAX_LEN (PGSIZE - PGSIZE / 4)  /* Largest compressed page. */
+
+/* A page of the pool. */
+struct zswap_page {
+	void *kva;
+	struct bitmap *used;        /* One bit per chunk. */
+	size_t free_chunks;
+	struct list_elem elem;      /* Element in pool. */
+};
+
+/* A compressed page. */
+struct zswap_entry {
+	struct zswap_page *zpage;   /* Pool page holding the data. */
+	size_t chunk;               /* First chunk. */
+	size_t len;                 /* Compressed size in bytes. */
+};
+
+size_t zswap_max_pages;         /* Pool size in pages, 0 to disable. */
+
+static struct list pool;
+static size_t pool_pages;       /* # of pages in pool. */
+static struct lock zswap_lock;  /* Guards everything below. */
+static uint8_t zswap_buf[PGSIZE];
+
+static long long stored_cnt;    /* # of pages stored. */
+static long long stored_bytes;  /* Compressed size of those pages. */
+static long long reject_cnt;    /* # of pages that did not compress. */
+static long long full_cnt;      /* # of pages turned away by a full pool. */
+
+static size_t lz_compress (const uint8_t *, size_t, uint8_t *, size_t);
+static size_t lz_decompress (const uint8_t *, size_t, uint8_t *, size_t);
+
+/* Initializes the compressed swap cache. */
+void
+zswap_init (void) {
+	list_init (&pool);
+	lock_init (&zswap_lock);
+}
+
+/* Finds room for LEN bytes in the pool, growing the pool if it may.
+ * Sets *ZPAGE and returns the first chunk, or returns BITMAP_ERROR if
+ * the pool is full. */
+static size_t
+pool_alloc (size_t len, struct zswap_page **zpage) {
+	size_t cnt = DIV_ROUND_UP (len, ZSWAP_CHUNK);
+	struct list_elem *e;
+	struct zswap_page *zp;
+	size_t chunk;
+
+	for (e = list_begin (&pool); e != list_end (&pool); e = list_next (e)) {
+		zp = list_entry (e, struct zswap_page, elem);
+		if (zp->free_chunks < cnt)
+			continue;
+		chunk = bitmap_scan_and_flip (zp->used, 0, cnt, false);
+		if (chunk != BITMAP_ERROR)
+			goto found;
+	}
+
+	if (pool_pages >= zswap_max_pages)
+		return BITMAP_ERROR;
+	zp = malloc (sizeof *zp);
+	if (zp == NULL)
+		return BITMAP_ERROR;
+	zp->kva = palloc_get_page (0);
+	zp->used = bitmap_create (ZSWAP_CHUNK_CNT);
+	if (zp->kva == NULL || zp->used == NULL) {
+		palloc_free_page (zp->kva);
+		if (zp->used != NULL)
+			bitmap_destroy (zp->used);
+		free (zp);
+		return BITMAP_ERROR;
+	}
+	zp->free_chunks = ZSWAP_CHUNK_CNT;
+	list_push_back (&pool, &zp->elem);
+	pool_pages++;
+	chunk = bitmap_scan_and_flip (zp->used, 0, cnt, false);
+
+found:
+	zp->free_chunks -= cnt;
+	*zpage = zp;
+	return chunk;
+}
+
+/* Compresses the page at KVA into the pool. Returns the entry, or NULL
+ * if the page has to go to the swap disk. */
+struct zswap_entry *
+zswap_store (const void *kva) {
+	struct zswap_entry *entry;
+	struct zswap_page *zpage;
+	size_t len, chunk;
+
+	if (zswap_max_pages == 0)
+		return NULL;
+	entry = malloc (sizeof *entry);
+	if (entry == NULL)
+		return NULL;
+
+	lock_acquire (&zswap_lock);
+	len = lz_compress (kva, PGSIZE, zswap_buf, ZSWAP_MAX_LEN);
+	if (len == 0) {
+		reject_cnt++;
+		goto fail;
+	}
+	chunk = pool_alloc (len, &zpage);
+	if (chunk == BITMAP_ERROR) {
+		full_cnt++;
+		goto fail;
+	}
+	memcpy (zpage->kva + chunk * ZSWAP_CHUNK, zswap_buf, len);
+	entry->zpage = zpage;
+	entry->chunk = chunk;
+	entry->len = len;
+	stored_cnt++;
+	stored_bytes += len;
+	lock_release (&zswap_lock);
+	return entry;
+
+fail:
+	lock_release (&zswap_lock);
+	free (entry);
+	return NULL;
+}
+
+/* Decompresses ENTRY into the page at KVA. ENTRY stays in the pool. */
+void
+zswap_load (struct zswap_entry *entry, void *kva) {
+	lock_acquire (&zswap_lock);
+	if (lz_decompress (entry->zpage->kva + entry->chunk * ZSWAP_CHUNK,
+				entry->len, kva, PGSIZE) != PGSIZE)
+		PANIC ("zswap: corrupted page");
+	lock_release (&zswap_lock);
+}
+
+/* Removes ENTRY from the pool, releasing the pool page once it is empty. */
+void
+zswap_free (struct zswap_entry *entry) {
+	struct zswap_page *zpage = entry->zpage;
+	size_t cnt = DIV_ROUND_UP (entry->len, ZSWAP_CHUNK);
+
+	lock_acquire (&zswap_lock);
+	bitmap_set_multiple (zpage->used, entry->chunk, cnt, false);
+	zpage->free_chunks += cnt;
+	if (zpage->free_chunks == ZSWAP_CHUNK_CNT) {
+		list_remove (&zpage->elem);
+		pool_pages--;
+		palloc_free_page (zpage->kva);
+		bitmap_destroy (zpage->used);
+		free (zpage);
+	}
+	lock_release (&zswap_lock);
+	free (entry);
+}
+
+/* Prints compressed swap cache statistics. */
+void
+zswap_print_stats (void) {
+	if (zswap_max_pages == 0)
+		return;
+	printf ("zswap: %lld pages stored in %lld bytes (ratio %lld%%), "
+			"%lld incompressible, %lld over pool limit, %zu pool pages\n",
+			stored_cnt, stored_bytes,
+			stored_bytes ? stored_cnt * PGSIZE * 100 / stored_bytes : 0,
+			reject_cnt, full_cnt, pool_pages);
+}
+
+/* LZ77 codec.
+ *
+ * The output is a series of sequences. A sequence starts with a token
+ * byte whose high nibble is the number of literals and low nibble the
+ * match length minus LZ_MIN_MATCH; 15 in either means that more length
+ * bytes follow, each added in until one is less than 255. The literals
+ * come next, then the 2 byte little endian match offset and the extra
+ * match length bytes. The last sequence has literals only. */
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+static uint16_t lz_table[1 << LZ_HASH_BITS];  /* Position + 1 by hash. */
+
+static uint32_t
+lz_read32 (const uint8_t *p) {
+	uint32_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+static size_t
+lz_hash (uint32_t v) {
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes LEN as a run of length bytes following a full nibble. */
+static uint8_t *
+lz_put_len (uint8_t *op, size_t len) {
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+/* Appends a sequence of LIT_LEN literals at LIT followed by a match of
+ * MATCH_LEN bytes at OFFSET, or no match if MATCH_LEN is 0, to OP.
+ * Returns the new end of the output, or NULL if it would pass OEND. */
+static uint8_t *
+lz_emit (uint8_t *op, const uint8_t *oend, const uint8_t *lit,
+		size_t lit_len, size_t offset, size_t match_len) {
+	size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+	if ((size_t) (oend - op) < 1 + lit_len / 255 + 1 + lit_len
+			+ (match_len ? 2 + ml / 255 + 1 : 0))
+		return NULL;
+	*op++ = (lit_len < 15 ? lit_len : 15) << 4 | (ml < 15 ? ml : 15);
+	if (lit_len >= 15)
+		op = lz_put_len (op, lit_len - 15);
+	memcpy (op, lit, lit_len);
+	op += lit_len;
+	if (match_len) {
+		*op++ = offset;
+		*op++ = offset >> 8;
+		if (ml >= 15)
+			op = lz_put_len (op, ml - 15);
+	}
+	return op;
+}
+
+/* Compresses the LEN bytes at SRC, which must be at most 65535, into
+ * DST. Returns the compressed size, or 0 if it would exceed CAP. */
+static size_t
+lz_compress (const uint8_t *src, size_t len, uint8_t *dst, size_t cap) {
+	const uint8_t *ip = src, *anchor = src, *end = src + len;
+	uint8_t *op = dst;
+	const uint8_t *oend = dst + cap;
+
+	ASSERT (len < UINT16_MAX);
+	memset (lz_table, 0, sizeof lz_table);
+	while (end - ip >= LZ_MIN_MATCH) {
+		size_t h = lz_hash (lz_read32 (ip));
+		const uint8_t *ref = src + lz_table[h] - 1;
+		bool hit = lz_table[h] != 0 && lz_read32 (ref) == lz_read32 (ip);
+
+		lz_table[h] = ip - src + 1;
+		if (!hit) {
+			ip++;
+			continue;
+		}
+		size_t match_len = LZ_MIN_MATCH;
+		while (ip + match_len < end && ref[match_len] == ip[match_len])
+			match_len++;
+		op = lz_emit (op, oend, anchor, ip - anchor, ip - ref, match_len);
+		if (op == NULL)
+			return 0;
+		ip += match_len;
+		anchor = ip;
+	}
+	op = lz_emit (op, oend, anchor, end - anchor, 0, 0);
+	return op != NULL ? (size_t) (op - dst) : 0;
+}
+
+/* Reads a run of length bytes at *IP, not passing IEND. */
+static size_t
+lz_get_len (const uint8_t **ip, const uint8_t *iend) {
+	size_t len = 0;
+	uint8_t b;
+
+	do {
+		if (*ip >= iend)
+			return SIZE_MAX;
+		b = *(*ip)++;
+		len += b;
+	} while (b == 255);
+	return len;
+}
+
+/* Decompresses the LEN bytes at SRC into DST, which has room for CAP
+ * bytes. Returns the decompressed size, or 0 if SRC is malformed. */
+static size_t
+lz_decompress (const uint8_t *src, size_t len, uint8_t *dst, size_t cap) {
+	const uint8_t *ip = src, *iend = src + len;
+	uint8_t *op = dst, *oend = dst + cap;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t lit_len = token >> 4;
+		if (lit_len == 15 && (lit_len += lz_get_len (&ip, iend)) < 15)
+			return 0;
+		if ((size_t) (iend - ip) < lit_len || (size_t) (oend - op) < lit_len)
+			return 0;
+		memcpy (op, ip, lit_len);
+		op += lit_len;
+		ip += lit_len;
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return 0;
+		size_t offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		size_t match_len = token & 15;
+		if (match_len == 15 && (match_len += lz_get_len (&ip, iend)) < 15)
+			return 0;
+		match_len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t) (op - dst)
+				|| (size_t) (oend - op) < match_len)
+			return 0;
+		/* Byte by byte, as the match may overlap its own output. */
+		for (const uint8_t *ref = op - offset; match_len > 0; match_len--)
+			*op++ = *ref++;
+	}
+	return op - dst;
+}